@@ -0,0 +1,135 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include <fwupdplugin.h>
+
+#include <sys/resource.h>
+
+#include "fu-hpi-cfu-sim-device.h"
+
+/* read and write system calls of the whole process, as counted by the kernel */
+static guint64
+fu_hpi_cfu_benchmark_get_syscalls(void)
+{
+	guint64 total = 0;
+	g_autofree gchar *buf = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	if (!g_file_get_contents("/proc/self/io", &buf, NULL, NULL))
+		return 0;
+	lines = g_strsplit(buf, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++) {
+		if (g_str_has_prefix(lines[i], "syscr: ") || g_str_has_prefix(lines[i], "syscw: "))
+			total += g_ascii_strtoull(lines[i] + 7, NULL, 10);
+	}
+	return total;
+}
+
+int
+main(int argc, char **argv)
+{
+	gint size = 65536;
+	gint bulk_acksize = 0;
+	gint latency = 0;
+	gint64 start_time;
+	gint64 wall_time;
+	guint64 syscalls;
+	guint64 packets;
+	guint64 transfer_ms;
+	struct rusage usage = {0};
+	g_autoptr(FuContext) ctx = fu_context_new();
+	g_autoptr(FuHpiCfuSimDevice) device = NULL;
+	g_autoptr(FuProgress) progress = fu_progress_new(G_STRLOC);
+	g_autoptr(FuProgress) progress_dry_run = fu_progress_new(G_STRLOC);
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) estimate = NULL;
+	g_autoptr(GHashTable) metadata = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GInputStream) stream_dry_run = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new(NULL);
+	const GOptionEntry options[] = {
+	    {"size", '\0', 0, G_OPTION_ARG_INT, &size, "Payload size in bytes", "BYTES"},
+	    {"acksize",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT,
+	     &bulk_acksize,
+	     "Bulk optimization value of the dock, 0 to 3",
+	     "VALUE"},
+	    {"latency", '\0', 0, G_OPTION_ARG_INT, &latency, "Delay of every transfer", "US"},
+	    {NULL}};
+
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (size <= 0 || bulk_acksize < 0 || bulk_acksize > 3 || latency < 0) {
+		g_printerr("invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+
+	device = fu_hpi_cfu_sim_device_new(ctx);
+	fu_hpi_cfu_sim_device_set_bulk_acksize(device, bulk_acksize);
+	fu_hpi_cfu_sim_device_set_latency(device, latency);
+	if (!fu_hpi_cfu_device_ensure_version(FU_HPI_CFU_DEVICE(device), &error)) {
+		g_printerr("failed to read version: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	blob = fu_hpi_cfu_sim_device_build_archive(size, &error);
+	if (blob == NULL) {
+		g_printerr("failed to build archive: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	/* what the dry run expects, to compare with the real transfer */
+	stream_dry_run = g_memory_input_stream_new_from_bytes(blob);
+	estimate = fu_hpi_cfu_device_dry_run(FU_HPI_CFU_DEVICE(device),
+					     stream_dry_run,
+					     progress_dry_run,
+					     &error);
+	if (estimate == NULL) {
+		g_printerr("failed to dry run: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	stream = g_memory_input_stream_new_from_bytes(blob);
+
+	/* version report, handshake, content and the swap-pending check */
+	syscalls = fu_hpi_cfu_benchmark_get_syscalls();
+	start_time = g_get_monotonic_time();
+	if (!fu_device_write_firmware(FU_DEVICE(device),
+				      stream,
+				      progress,
+				      FWUPD_INSTALL_FLAG_NONE,
+				      &error)) {
+		g_printerr("failed to write: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	wall_time = g_get_monotonic_time() - start_time;
+	syscalls = fu_hpi_cfu_benchmark_get_syscalls() - syscalls;
+	getrusage(RUSAGE_SELF, &usage);
+
+	metadata = fu_device_report_metadata_post(FU_DEVICE(device));
+	packets = g_ascii_strtoull(g_hash_table_lookup(metadata, "HpiCfuPacketsSent"), NULL, 10);
+	transfer_ms = g_ascii_strtoull(g_hash_table_lookup(metadata, "HpiCfuTransferMs"), NULL, 10);
+	g_print("size=%i acksize=%i latency=%ius wall=%.1fms transfer=%" G_GUINT64_FORMAT
+		"ms (estimate %sms) reports=%" G_GUINT64_FORMAT " reports/s=%.0f"
+		" syscalls=%" G_GUINT64_FORMAT " peak-rss=%likB\n",
+		size,
+		bulk_acksize,
+		latency,
+		(gdouble)wall_time / 1000.f,
+		transfer_ms,
+		(const gchar *)g_hash_table_lookup(estimate, "HpiCfuDryRunTransferMs"),
+		packets,
+		transfer_ms > 0 ? (gdouble)packets * 1000.f / transfer_ms : 0.f,
+		syscalls,
+		usage.ru_maxrss);
+	return EXIT_SUCCESS;
+}
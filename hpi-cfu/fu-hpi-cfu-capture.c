@@ -0,0 +1,278 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include <errno.h>
+
+#include "fu-hpi-cfu-capture.h"
+#include "fu-hpi-cfu-struct.h"
+
+/*
+ * Writes the transfers of one update to a pcapng file in the same format as a usbmon
+ * capture, so that it can be opened in Wireshark and similar tools. Each transfer is
+ * written as a submit and a complete event, each with its own timestamp.
+ */
+struct _FuHpiCfuCapture {
+	GObject parent_instance;
+	GOutputStream *stream;
+	guint8 busnum;
+	guint8 devnum;
+	guint64 id;
+};
+
+G_DEFINE_TYPE(FuHpiCfuCapture, fu_hpi_cfu_capture, G_TYPE_OBJECT)
+
+static gboolean
+fu_hpi_cfu_capture_write(FuHpiCfuCapture *self, GByteArray *buf, GError **error)
+{
+	return g_output_stream_write_all(self->stream, buf->data, buf->len, NULL, NULL, error);
+}
+
+static gboolean
+fu_hpi_cfu_capture_add_packet(FuHpiCfuCapture *self,
+			      gint64 timestamp,
+			      GByteArray *st_usbmon,
+			      const guint8 *buf,
+			      gsize bufsz,
+			      GError **error)
+{
+	gsize packetsz = st_usbmon->len + bufsz;
+	gsize paddingsz = (4 - (packetsz % 4)) % 4;
+	guint32 block_length = FU_STRUCT_HPI_CFU_PCAPNG_PACKET_HDR_SIZE + packetsz + paddingsz + 4;
+	g_autoptr(GByteArray) st = fu_struct_hpi_cfu_pcapng_packet_hdr_new();
+
+	fu_struct_hpi_cfu_pcapng_packet_hdr_set_block_length(st, block_length);
+	fu_struct_hpi_cfu_pcapng_packet_hdr_set_timestamp_high(st, (guint64)timestamp >> 32);
+	fu_struct_hpi_cfu_pcapng_packet_hdr_set_timestamp_low(st, (guint64)timestamp & G_MAXUINT32);
+	fu_struct_hpi_cfu_pcapng_packet_hdr_set_captured_length(st, packetsz);
+	fu_struct_hpi_cfu_pcapng_packet_hdr_set_original_length(st, packetsz);
+	g_byte_array_append(st, st_usbmon->data, st_usbmon->len);
+	if (bufsz > 0)
+		g_byte_array_append(st, buf, bufsz);
+	fu_byte_array_set_size(st, st->len + paddingsz, 0x0);
+	fu_byte_array_append_uint32(st, block_length, G_LITTLE_ENDIAN);
+	return fu_hpi_cfu_capture_write(self, st, error);
+}
+
+static GByteArray *
+fu_hpi_cfu_capture_usbmon_new(FuHpiCfuCapture *self,
+			      gchar event_type,
+			      FuHpiCfuUsbmonXferType xfer_type,
+			      guint8 endpoint,
+			      gint64 timestamp,
+			      gint32 status)
+{
+	g_autoptr(GByteArray) st = fu_struct_hpi_cfu_usbmon_hdr_new();
+
+	fu_struct_hpi_cfu_usbmon_hdr_set_id(st, self->id);
+	fu_struct_hpi_cfu_usbmon_hdr_set_event_type(st, event_type);
+	fu_struct_hpi_cfu_usbmon_hdr_set_xfer_type(st, xfer_type);
+	fu_struct_hpi_cfu_usbmon_hdr_set_epnum(st, endpoint);
+	fu_struct_hpi_cfu_usbmon_hdr_set_devnum(st, self->devnum);
+	fu_struct_hpi_cfu_usbmon_hdr_set_busnum(st, self->busnum);
+	fu_struct_hpi_cfu_usbmon_hdr_set_flag_setup(st, '-');
+	fu_struct_hpi_cfu_usbmon_hdr_set_ts_sec(st, timestamp / G_USEC_PER_SEC);
+	fu_struct_hpi_cfu_usbmon_hdr_set_ts_usec(st, timestamp % G_USEC_PER_SEC);
+	fu_struct_hpi_cfu_usbmon_hdr_set_status(st, (guint32)status);
+	return g_steal_pointer(&st);
+}
+
+static gint32
+fu_hpi_cfu_capture_status_from_error(const GError *error_transfer)
+{
+	if (error_transfer == NULL)
+		return 0;
+	if (g_error_matches(error_transfer, FWUPD_ERROR, FWUPD_ERROR_TIMED_OUT))
+		return -ETIMEDOUT;
+	if (g_error_matches(error_transfer, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return -ECONNRESET;
+	return -EPIPE;
+}
+
+/* the submit and complete events for one transfer, with the data on the side that has it */
+static gboolean
+fu_hpi_cfu_capture_add_transfer(FuHpiCfuCapture *self,
+				FuHpiCfuUsbmonXferType xfer_type,
+				guint8 endpoint,
+				const guint8 *setup,
+				const guint8 *buf,
+				gsize bufsz,
+				gsize actual_length,
+				gint64 submit_time,
+				const GError *error_transfer,
+				GError **error)
+{
+	gboolean is_in = (endpoint & 0x80) > 0;
+	gint64 complete_time = g_get_real_time();
+	g_autoptr(GByteArray) st_submit = NULL;
+	g_autoptr(GByteArray) st_complete = NULL;
+
+	self->id++;
+
+	/* submit */
+	st_submit = fu_hpi_cfu_capture_usbmon_new(self,
+						  'S',
+						  xfer_type,
+						  endpoint,
+						  submit_time,
+						  -EINPROGRESS);
+	if (setup != NULL) {
+		fu_struct_hpi_cfu_usbmon_hdr_set_flag_setup(st_submit, 0);
+		if (!fu_struct_hpi_cfu_usbmon_hdr_set_setup(st_submit, setup, 8, error))
+			return FALSE;
+	}
+	fu_struct_hpi_cfu_usbmon_hdr_set_length(st_submit, bufsz);
+	if (is_in) {
+		fu_struct_hpi_cfu_usbmon_hdr_set_flag_data(st_submit, '<');
+		if (!fu_hpi_cfu_capture_add_packet(self, submit_time, st_submit, NULL, 0, error))
+			return FALSE;
+	} else {
+		fu_struct_hpi_cfu_usbmon_hdr_set_len_cap(st_submit, bufsz);
+		if (!fu_hpi_cfu_capture_add_packet(self, submit_time, st_submit, buf, bufsz, error))
+			return FALSE;
+	}
+
+	/* complete */
+	st_complete =
+	    fu_hpi_cfu_capture_usbmon_new(self,
+					  'C',
+					  xfer_type,
+					  endpoint,
+					  complete_time,
+					  fu_hpi_cfu_capture_status_from_error(error_transfer));
+	fu_struct_hpi_cfu_usbmon_hdr_set_length(st_complete, actual_length);
+	if (is_in && error_transfer == NULL) {
+		fu_struct_hpi_cfu_usbmon_hdr_set_len_cap(st_complete, actual_length);
+		return fu_hpi_cfu_capture_add_packet(self,
+						     complete_time,
+						     st_complete,
+						     buf,
+						     actual_length,
+						     error);
+	}
+	fu_struct_hpi_cfu_usbmon_hdr_set_flag_data(st_complete, '>');
+	return fu_hpi_cfu_capture_add_packet(self, complete_time, st_complete, NULL, 0, error);
+}
+
+gboolean
+fu_hpi_cfu_capture_add_control(FuHpiCfuCapture *self,
+			       guint8 request_type,
+			       guint8 request,
+			       guint16 value,
+			       guint16 idx,
+			       const guint8 *buf,
+			       gsize bufsz,
+			       gsize actual_length,
+			       gint64 submit_time,
+			       const GError *error_transfer,
+			       GError **error)
+{
+	guint8 setup[8] = {request_type, request};
+
+	g_return_val_if_fail(FU_IS_HPI_CFU_CAPTURE(self), FALSE);
+
+	fu_memwrite_uint16(setup + 2, value, G_LITTLE_ENDIAN);
+	fu_memwrite_uint16(setup + 4, idx, G_LITTLE_ENDIAN);
+	fu_memwrite_uint16(setup + 6, bufsz, G_LITTLE_ENDIAN);
+	return fu_hpi_cfu_capture_add_transfer(self,
+					       FU_HPI_CFU_USBMON_XFER_TYPE_CONTROL,
+					       request_type & 0x80,
+					       setup,
+					       buf,
+					       bufsz,
+					       actual_length,
+					       submit_time,
+					       error_transfer,
+					       error);
+}
+
+gboolean
+fu_hpi_cfu_capture_add_interrupt(FuHpiCfuCapture *self,
+				 guint8 endpoint,
+				 const guint8 *buf,
+				 gsize bufsz,
+				 gsize actual_length,
+				 gint64 submit_time,
+				 const GError *error_transfer,
+				 GError **error)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_CAPTURE(self), FALSE);
+	return fu_hpi_cfu_capture_add_transfer(self,
+					       FU_HPI_CFU_USBMON_XFER_TYPE_INTERRUPT,
+					       endpoint,
+					       NULL,
+					       buf,
+					       bufsz,
+					       actual_length,
+					       submit_time,
+					       error_transfer,
+					       error);
+}
+
+/**
+ * fu_hpi_cfu_capture_new:
+ * @filename: the pcapng file to create, replacing any existing file
+ * @busnum: USB bus number
+ * @devnum: USB device address
+ * @error: (nullable): optional return location for an error
+ *
+ * Creates a capture file and writes the section and interface headers.
+ *
+ * Returns: (transfer full): a #FuHpiCfuCapture, or %NULL on error
+ **/
+FuHpiCfuCapture *
+fu_hpi_cfu_capture_new(const gchar *filename, guint8 busnum, guint8 devnum, GError **error)
+{
+	g_autoptr(FuHpiCfuCapture) self = g_object_new(FU_TYPE_HPI_CFU_CAPTURE, NULL);
+	g_autoptr(GFile) file = g_file_new_for_path(filename);
+	g_autoptr(GByteArray) st_shb = fu_struct_hpi_cfu_pcapng_section_hdr_new();
+	g_autoptr(GByteArray) st_idb = fu_struct_hpi_cfu_pcapng_interface_desc_new();
+
+	g_return_val_if_fail(filename != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	self->busnum = busnum;
+	self->devnum = devnum;
+	self->stream =
+	    G_OUTPUT_STREAM(g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error));
+	if (self->stream == NULL) {
+		g_prefix_error(error, "failed to create %s: ", filename);
+		return NULL;
+	}
+	if (!fu_hpi_cfu_capture_write(self, st_shb, error))
+		return NULL;
+	if (!fu_hpi_cfu_capture_write(self, st_idb, error))
+		return NULL;
+
+	/* success */
+	return g_steal_pointer(&self);
+}
+
+static void
+fu_hpi_cfu_capture_init(FuHpiCfuCapture *self)
+{
+}
+
+static void
+fu_hpi_cfu_capture_finalize(GObject *object)
+{
+	FuHpiCfuCapture *self = FU_HPI_CFU_CAPTURE(object);
+
+	if (self->stream != NULL) {
+		g_output_stream_close(self->stream, NULL, NULL);
+		g_object_unref(self->stream);
+	}
+
+	G_OBJECT_CLASS(fu_hpi_cfu_capture_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_capture_class_init(FuHpiCfuCaptureClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = fu_hpi_cfu_capture_finalize;
+}
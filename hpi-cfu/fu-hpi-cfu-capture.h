@@ -0,0 +1,36 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_CAPTURE (fu_hpi_cfu_capture_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuCapture, fu_hpi_cfu_capture, FU, HPI_CFU_CAPTURE, GObject)
+
+FuHpiCfuCapture *
+fu_hpi_cfu_capture_new(const gchar *filename, guint8 busnum, guint8 devnum, GError **error);
+gboolean
+fu_hpi_cfu_capture_add_control(FuHpiCfuCapture *self,
+			       guint8 request_type,
+			       guint8 request,
+			       guint16 value,
+			       guint16 idx,
+			       const guint8 *buf,
+			       gsize bufsz,
+			       gsize actual_length,
+			       gint64 submit_time,
+			       const GError *error_transfer,
+			       GError **error);
+gboolean
+fu_hpi_cfu_capture_add_interrupt(FuHpiCfuCapture *self,
+				 guint8 endpoint,
+				 const guint8 *buf,
+				 gsize bufsz,
+				 gsize actual_length,
+				 gint64 submit_time,
+				 const GError *error_transfer,
+				 GError **error);
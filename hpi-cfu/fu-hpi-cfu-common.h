@@ -0,0 +1,15 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+/* report IDs of the CFU HID interface */
+#define FIRMWARE_REPORT_ID    0x20
+#define CONTENT_ACK_REPORT_ID 0x22
+#define OFFER_REPORT_ID	      0x25
+
+/* the most payload data in one content report */
+#define FU_HPI_CFU_PAYLOAD_LENGTH 52
@@ -6,50 +6,136 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "fu-cfu-struct.h"
+#include "fu-hpi-cfu-capture.h"
+#include "fu-hpi-cfu-common.h"
 #include "fu-hpi-cfu-device.h"
+#include "fu-hpi-cfu-image.h"
+#include "fu-hpi-cfu-manifest.h"
+#include "fu-hpi-cfu-offer.h"
+#include "fu-hpi-cfu-power.h"
+#include "fu-hpi-cfu-probes.h"
+#include "fu-hpi-cfu-recorder.h"
 #include "fu-hpi-cfu-struct.h"
 
 /*******************************************/
 /*            USB PROTOCOL DEFINES         */
 /*******************************************/
 
-#define GET_REPORT	   0x01
-#define SET_REPORT	   0x09
-#define FIRMWARE_REPORT_ID 0x20
-#define OFFER_REPORT_ID	   0x25
-#define END_POINT_ADDRESS  0x81
+#define GET_REPORT	  0x01
+#define SET_REPORT	  0x09
+#define END_POINT_ADDRESS 0x81
 
 #define IN_REPORT_TYPE	    0x0100
 #define OUT_REPORT_TYPE	    0x0200
 #define FEATURE_REPORT_TYPE 0x0300
 
-#define FU_HPI_CFU_PAYLOAD_LENGTH 52
-#define FU_HPI_CFU_DEVICE_TIMEOUT 0 /* ms */
+/* the last content ack only arrives once the dock has verified the image */
+#define FU_HPI_CFU_DEVICE_TIMEOUT 30000 /* ms */
 
-struct _FuHpiCfuDeviceClass {
-	FuUsbDeviceClass parent_class;
-};
+/* an idle dock answers at once, so anything slower is a stale or missing reply */
+#define FU_HPI_CFU_DEVICE_ABORT_TIMEOUT 500 /* ms */
+#define FU_HPI_CFU_DEVICE_ABORT_DRAIN	16  /* reports */
+
+/* nothing should be queued before an update, so only wait long enough to catch a stale reply */
+#define FU_HPI_CFU_DEVICE_RESYNC_TIMEOUT 20 /* ms */
+
+#define FU_HPI_CFU_DEVICE_FLAG_FORCE_VERSION "force-version"
+#define FU_HPI_CFU_DEVICE_FLAG_FORCE_RESET   "force-reset"
+#define FU_HPI_CFU_DEVICE_FLAG_PIPELINED     "pipelined-handshake"
+#define FU_HPI_CFU_DEVICE_FLAG_DEFERRED	     "deferred-activation"
+
+/* events kept for the failure report, at 24 bytes each */
+#define FU_HPI_CFU_DEVICE_RECORDER_SIZE 256
+
+/* failure reports kept on disk for all the docks, the oldest are deleted first */
+#define FU_HPI_CFU_DEVICE_FLIGHT_RECORDS_MAX 10
+
+/* version report round trips averaged for the dry-run estimate */
+#define FU_HPI_CFU_DEVICE_LATENCY_SAMPLES 8
+
+/* archives kept decoded at any one time, one is usually enough for a fleet rollout */
+#define FU_HPI_CFU_IMAGE_CACHE_MAX 4
+
+/* summary of the last update, kept across the replug for the history database */
+typedef struct {
+	gsize image_size;
+	gint64 start_time;     /* µs, monotonic */
+	gint64 transfer_start; /* µs, monotonic */
+	gint64 done_time;      /* µs, monotonic */
+	gint64 handshake_time; /* µs */
+	gint64 transfer_time;  /* µs */
+	gint64 replug_time;    /* µs */
+	guint32 packets_sent;
+	guint busy_events;
+	guint retries;
+	gint32 reject_reason;  /* -1 if never rejected */
+	gint32 content_status; /* -1 if no content acked */
+	guint rtt_count;       /* content acks timed */
+	gint64 rtt_min;	       /* µs */
+	gint64 rtt_max;	       /* µs */
+	gint64 rtt_last;       /* µs */
+	gdouble rtt_mean;      /* µs */
+	gdouble rtt_jitter;    /* µs, as the RFC 3550 interarrival jitter */
+} FuHpiCfuDeviceTelemetry;
+
+/* an image being packetized on another thread while the handshake runs */
+typedef struct {
+	GThread *thread;      /* (nullable) */
+	FuHpiCfuImage *image; /* (nullable): only while the thread runs */
+	GError *error;	      /* (nullable) */
+} FuHpiCfuDevicePacketizeHelper;
+
+/* what the state machine is writing, only set while ->write_firmware runs */
+typedef struct {
+	FuHpiCfuImage *image;		/* the image being offered */
+	FuHpiCfuImage *image_alternate; /* (nullable): owned, offered on a bank reject */
+} FuHpiCfuHandlerOptions;
 
 typedef struct {
 	guint8 iface_number;
 	FuHpiCfuState state;
-	guint8 force_version;
-	guint8 force_reset;
-	gint32 sequence_number;
-	gint32 currentaddress;
-	gint32 bytes_sent;
+	guint8 offer_flags; /* FuHpiCfuOfferFlag */
+	guint32 sequence_number; /* reports sent, the 16 bit wire value wraps */
+	gsize bytes_sent;
 	gint32 retry_attempts;
-	gint32 payload_file_size;
-	gint32 bytes_remaining;
 	gint32 last_packet_sent;
 	gint32 bulk_acksize;
-	gint32 curfilepos;
 	gboolean firmware_status;
 	gboolean exit_state_machine_framework;
+	gboolean skip_replug;
+	gboolean rebooting; /* the last install ended with the dock rebooting */
+	guint64 max_transfer_rate; /* payload bytes per second, or 0 for no limit */
+	gint worker_policy;	   /* SCHED_OTHER, SCHED_BATCH, SCHED_FIFO or SCHED_RR */
+	gint worker_nice;
+	guint64 worker_cpus; /* bitmask, 0 for any */
+	gint64 submit_time;  /* µs, monotonic, of the last content report */
+	gboolean swap_pending; /* the dock has staged the image and waits for a reset */
+	FuHpiCfuImage *image; /* (nullable): found in the cache by ->prepare_firmware */
+	gchar *cache_key;     /* (nullable): archive checksum, and the prefix if any */
+	gchar *image_prefix;  /* (nullable): from the archive manifest */
+	gchar *image_alternate_prefix; /* (nullable): for the other flash bank */
+	FuHpiCfuImage *image_alternate; /* (nullable): decoded by ->prepare_firmware */
+	gboolean bank_rejected;	       /* the last offer was for the wrong bank */
+	guint8 component_id;
+	FuHpiCfuDevicePacketizeHelper packetize;
+	FuHpiCfuHandlerOptions handler_options;
+	gboolean writing; /* the main context is iterated meanwhile, so guards re-entry */
+	GCancellable *cancellable;
+	GMainContext *context; /* (nullable): owner of the FuProgress while writing */
+	GHashTable *image_cache; /* (nullable): cache_key:FuHpiCfuImage, owned by the plugin */
+	FuHpiCfuDeviceTelemetry telemetry;
+	FuHpiCfuCapture *capture; /* (nullable): only while writing */
+	gchar *capture_directory; /* (nullable) */
+	FuHpiCfuRecorder *recorder;
 } FuHpiCfuDevicePrivate;
 
 typedef gint32 (*FuHpiCfuStateHandler)(FuHpiCfuDevice *self,
@@ -58,22 +144,344 @@ typedef gint32 (*FuHpiCfuStateHandler)(FuHpiCfuDevice *self,
 				       void *options,
 				       GError **error);
 
-typedef struct {
-	FuFirmware *fw_offer;
-	FuFirmware *fw_payload;
-} FuHpiCfuHandlerOptions;
-
-FuHpiCfuHandlerOptions handler_options;
-
 typedef struct {
 	FuHpiCfuState state_no;
 	FuHpiCfuStateHandler handler;
-	void *options;
 } FuHpiCfuStateMachineFramework;
 
+typedef struct {
+	FuHpiCfuDevice *self;
+	FuProgress *progress;
+	gboolean ret;
+	gboolean done;
+	GError *error;
+} FuHpiCfuDeviceWorkerHelper;
+
 G_DEFINE_TYPE_WITH_PRIVATE(FuHpiCfuDevice, fu_hpi_cfu_device, FU_TYPE_HID_DEVICE)
 #define GET_PRIVATE(o) (fu_hpi_cfu_device_get_instance_private(o))
 
+/* content reports sent for each ack, as set by the bulk optimization value */
+static guint
+fu_hpi_cfu_device_get_ack_window(FuHpiCfuDevicePrivate *priv)
+{
+	switch (priv->bulk_acksize) {
+	case 1:
+		return 16;
+	case 2:
+		return 32;
+	case 3:
+		return 64;
+	default:
+		return 1;
+	}
+}
+
+static gpointer
+fu_hpi_cfu_device_packetize_cb(gpointer user_data)
+{
+	FuHpiCfuDevicePacketizeHelper *helper = (FuHpiCfuDevicePacketizeHelper *)user_data;
+	fu_hpi_cfu_image_packetize(helper->image, &helper->error);
+	return NULL;
+}
+
+/* the archive was validated in ->prepare_firmware, only the reports are left to build */
+static gboolean
+fu_hpi_cfu_device_packetize_start(FuHpiCfuDevice *self, FuHpiCfuImage *image, GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	priv->packetize.image = g_object_ref(image);
+	priv->packetize.thread = g_thread_try_new("hpi-cfu-packetize",
+						  fu_hpi_cfu_device_packetize_cb,
+						  &priv->packetize,
+						  error);
+	if (priv->packetize.thread == NULL) {
+		g_clear_object(&priv->packetize.image);
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static void
+fu_hpi_cfu_device_packetize_join(FuHpiCfuDevicePrivate *priv)
+{
+	if (priv->packetize.thread == NULL)
+		return;
+	g_thread_join(priv->packetize.thread);
+	priv->packetize.thread = NULL;
+	g_clear_object(&priv->packetize.image);
+}
+
+/* waits for the reports built alongside the handshake, if not already done */
+static gboolean
+fu_hpi_cfu_device_ensure_reports(FuHpiCfuDevicePrivate *priv, GError **error)
+{
+	fu_hpi_cfu_device_packetize_join(priv);
+	if (priv->packetize.error != NULL) {
+		g_propagate_error(error, g_steal_pointer(&priv->packetize.error));
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_device_real_control_transfer(FuHpiCfuDevice *self,
+					FuUsbDirection direction,
+					guint8 request,
+					guint16 value,
+					guint16 idx,
+					guint8 *data,
+					gsize length,
+					gsize *actual_length,
+					guint timeout,
+					GCancellable *cancellable,
+					GError **error)
+{
+	return fu_usb_device_control_transfer(FU_USB_DEVICE(self),
+					      direction,
+					      FU_USB_REQUEST_TYPE_VENDOR,
+					      FU_USB_RECIPIENT_DEVICE,
+					      request,
+					      value,
+					      idx,
+					      data,
+					      length,
+					      actual_length,
+					      timeout,
+					      cancellable,
+					      error);
+}
+
+static gboolean
+fu_hpi_cfu_device_real_interrupt_transfer(FuHpiCfuDevice *self,
+					  guint8 endpoint,
+					  guint8 *data,
+					  gsize length,
+					  gsize *actual_length,
+					  guint timeout,
+					  GCancellable *cancellable,
+					  GError **error)
+{
+	return fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
+						endpoint,
+						data,
+						length,
+						actual_length,
+						timeout,
+						cancellable,
+						error);
+}
+
+/* a capture that cannot be written is not worth failing the update for */
+static void
+fu_hpi_cfu_device_capture_failed(FuHpiCfuDevice *self, GError *error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_warning("failed to capture, stopping: %s", error->message);
+	g_clear_object(&priv->capture);
+}
+
+static gboolean
+fu_hpi_cfu_device_write_report_full(FuHpiCfuDevice *self,
+				    guint8 report_id,
+				    guint8 *buf,
+				    gsize bufsz,
+				    guint timeout,
+				    GCancellable *cancellable,
+				    GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	gboolean ret;
+	gint64 submit_time = priv->capture != NULL ? g_get_real_time() : 0;
+	g_autoptr(GError) error_local = NULL;
+
+	ret = FU_HPI_CFU_DEVICE_GET_CLASS(self)->control_transfer(self,
+								   FU_USB_DIRECTION_HOST_TO_DEVICE,
+								   SET_REPORT,
+								   OUT_REPORT_TYPE | report_id,
+								   0,
+								   buf,
+								   bufsz,
+								   NULL,
+								   timeout,
+								   cancellable,
+								   &error_local);
+	if (priv->capture != NULL) {
+		g_autoptr(GError) error_capture = NULL;
+		if (!fu_hpi_cfu_capture_add_control(priv->capture,
+						    0x40,
+						    SET_REPORT,
+						    OUT_REPORT_TYPE | report_id,
+						    0,
+						    buf,
+						    bufsz,
+						    ret ? bufsz : 0,
+						    submit_time,
+						    error_local,
+						    &error_capture))
+			fu_hpi_cfu_device_capture_failed(self, error_capture);
+	}
+	if (!ret) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_device_write_report(FuHpiCfuDevice *self,
+			       guint8 report_id,
+			       guint8 *buf,
+			       gsize bufsz,
+			       GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	return fu_hpi_cfu_device_write_report_full(self,
+						   report_id,
+						   buf,
+						   bufsz,
+						   FU_HPI_CFU_DEVICE_TIMEOUT,
+						   priv->cancellable,
+						   error);
+}
+
+static gboolean
+fu_hpi_cfu_device_read_report_full(FuHpiCfuDevice *self,
+				   guint8 *buf,
+				   gsize bufsz,
+				   gsize *actual_length,
+				   guint timeout,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	gboolean ret;
+	gint64 submit_time = priv->capture != NULL ? g_get_real_time() : 0;
+	g_autoptr(GError) error_local = NULL;
+
+	ret = FU_HPI_CFU_DEVICE_GET_CLASS(self)->interrupt_transfer(self,
+								     END_POINT_ADDRESS,
+								     buf,
+								     bufsz,
+								     actual_length,
+								     timeout,
+								     cancellable,
+								     &error_local);
+	if (priv->capture != NULL) {
+		g_autoptr(GError) error_capture = NULL;
+		if (!fu_hpi_cfu_capture_add_interrupt(priv->capture,
+						      END_POINT_ADDRESS,
+						      buf,
+						      bufsz,
+						      ret ? *actual_length : 0,
+						      submit_time,
+						      error_local,
+						      &error_capture))
+			fu_hpi_cfu_device_capture_failed(self, error_capture);
+	}
+	if (!ret) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+/* the feature report with the firmware versions, and also a cheap way to check the dock
+ * is responding */
+static gboolean
+fu_hpi_cfu_device_read_version_report(FuHpiCfuDevice *self,
+				      guint8 *buf,
+				      gsize bufsz,
+				      gsize *actual_length,
+				      guint timeout,
+				      GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	gboolean ret;
+	gint64 submit_time = priv->capture != NULL ? g_get_real_time() : 0;
+	g_autoptr(GError) error_local = NULL;
+
+	ret = FU_HPI_CFU_DEVICE_GET_CLASS(self)->control_transfer(self,
+								   FU_USB_DIRECTION_DEVICE_TO_HOST,
+								   GET_REPORT,
+								   FEATURE_REPORT_TYPE | FIRMWARE_REPORT_ID,
+								   priv->iface_number,
+								   buf,
+								   bufsz,
+								   actual_length,
+								   timeout,
+								   NULL,
+								   &error_local);
+	if (priv->capture != NULL) {
+		g_autoptr(GError) error_capture = NULL;
+		if (!fu_hpi_cfu_capture_add_control(priv->capture,
+						    0xC0,
+						    GET_REPORT,
+						    FEATURE_REPORT_TYPE | FIRMWARE_REPORT_ID,
+						    priv->iface_number,
+						    buf,
+						    bufsz,
+						    ret ? *actual_length : 0,
+						    submit_time,
+						    error_local,
+						    &error_capture))
+			fu_hpi_cfu_device_capture_failed(self, error_capture);
+	}
+	if (!ret) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_device_read_report(FuHpiCfuDevice *self,
+			      guint8 *buf,
+			      gsize bufsz,
+			      gsize *actual_length,
+			      GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	return fu_hpi_cfu_device_read_report_full(self,
+						  buf,
+						  bufsz,
+						  actual_length,
+						  FU_HPI_CFU_DEVICE_TIMEOUT,
+						  priv->cancellable,
+						  error);
+}
+
+static gboolean
+fu_hpi_cfu_device_step_done_cb(gpointer user_data)
+{
+	FuProgress *progress = FU_PROGRESS(user_data);
+	fu_progress_step_done(progress);
+	return G_SOURCE_REMOVE;
+}
+
+/* FuProgress is not thread-safe, so step it from the context that owns it */
+static void
+fu_hpi_cfu_device_step_done(FuHpiCfuDevice *self, FuProgress *progress)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	if (priv->context == NULL) {
+		fu_progress_step_done(progress);
+		return;
+	}
+	g_main_context_invoke(priv->context, fu_hpi_cfu_device_step_done_cb, progress);
+}
+
 static gboolean
 fu_hpi_cfu_start_entire_transaction(FuHpiCfuDevice *self, GError **error)
 {
@@ -103,18 +511,10 @@ fu_hpi_cfu_start_entire_transaction(FuHpiCfuDevice *self, GError **error)
 		      "fu_hpi_cfu_start_entire_transaction sending:",
 		      start_entire_trans_request);
 
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_HOST_TO_DEVICE,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    SET_REPORT,
-					    OUT_REPORT_TYPE | OFFER_REPORT_ID,
-					    0,
+	if (!fu_hpi_cfu_device_write_report(self,
+					    OFFER_REPORT_ID,
 					    buf_out->data,
 					    buf_out->len,
-					    NULL,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
 					    &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
@@ -138,14 +538,7 @@ fu_hpi_cfu_start_entire_transaction_accepted(FuHpiCfuDevice *self,
 	guint8 buf[128] = {0};
 	g_autoptr(GBytes) start_entire_trans_response = NULL;
 
-	if (!fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
-					      END_POINT_ADDRESS,
-					      buf,
-					      sizeof(buf),
-					      &actual_length,
-					      FU_HPI_CFU_DEVICE_TIMEOUT,
-					      NULL,
-					      &error_local)) {
+	if (!fu_hpi_cfu_device_read_report(self, buf, sizeof(buf), &actual_length, &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
 			    FWUPD_ERROR_NOT_SUPPORTED,
@@ -196,18 +589,10 @@ fu_hpi_cfu_send_start_offer_list(FuHpiCfuDevice *self, GError **error)
 		      "fu_hpi_cfu_send_start_offer_list: sending",
 		      start_offer_list_request);
 
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_HOST_TO_DEVICE,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    SET_REPORT,
-					    OUT_REPORT_TYPE | OFFER_REPORT_ID,
-					    0,
+	if (!fu_hpi_cfu_device_write_report(self,
+					    OFFER_REPORT_ID,
 					    start_offer_list_buf,
 					    sizeof(start_offer_list_buf),
-					    NULL,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
 					    &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
@@ -230,14 +615,7 @@ fu_hpi_cfu_send_offer_list_accepted(FuHpiCfuDevice *self, gint *status, GError *
 	g_autoptr(GBytes) send_offer_list_response = NULL;
 	*status = 0;
 
-	if (!fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
-					      END_POINT_ADDRESS,
-					      buf,
-					      sizeof(buf),
-					      &actual_length,
-					      FU_HPI_CFU_DEVICE_TIMEOUT,
-					      NULL,
-					      &error_local)) {
+	if (!fu_hpi_cfu_device_read_report(self, buf, sizeof(buf), &actual_length, &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
 			    FWUPD_ERROR_NOT_SUPPORTED,
@@ -273,55 +651,29 @@ fu_hpi_cfu_send_offer_list_accepted(FuHpiCfuDevice *self, gint *status, GError *
 	return TRUE;
 }
 
-static guint8
-fu_hpi_cfu_set_flag(guint8 val, guint8 position)
-{
-	return val | (1 << (position - 1));
-}
-
 static gboolean
-fu_hpi_cfu_send_offer_update_command(FuHpiCfuDevice *self, FuFirmware *fw_offer, GError **error)
+fu_hpi_cfu_send_offer_update_command(FuHpiCfuDevice *self,
+				     FuHpiCfuDevicePrivate *priv,
+				     GBytes *blob_offer,
+				     GError **error)
 {
-	g_autoptr(GByteArray) st_req = fu_struct_hpi_cfu_offer_cmd_new();
+	g_autoptr(GByteArray) st_req = NULL;
 	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GBytes) blob_offer = NULL;
 	g_autoptr(GBytes) offer_command_request = NULL;
 
-	const guint8 *data = 0;
-	gsize size = 0;
-	guchar flag = 0x00;
-	guint8 flag_value = 0;
-
-	blob_offer = fu_firmware_get_bytes(fw_offer, NULL);
-	data = g_bytes_get_data(blob_offer, &size);
-
-	fu_struct_hpi_cfu_payload_cmd_set_report_id(st_req, OFFER_REPORT_ID);
-
-	if (!fu_memcpy_safe(st_req->data + 1, 16, 0x0, data, 16, 0x0, 16, error)) {
+	st_req = fu_hpi_cfu_offer_build_cmd(blob_offer, priv->offer_flags, error);
+	if (st_req == NULL)
 		return FALSE;
-	}
-
-	flag_value = fu_hpi_cfu_set_flag(flag, 7);	 /* (Update now) */
-	flag_value = fu_hpi_cfu_set_flag(flag_value, 8); /* (Force update version) */
-	fu_struct_hpi_cfu_offer_cmd_set_flags(st_req, flag_value);
 
 	offer_command_request = g_bytes_new(st_req->data, st_req->len);
 	fu_dump_bytes(G_LOG_DOMAIN,
 		      "fu_hpi_cfu_send_offer_update_command sending:",
 		      offer_command_request);
 
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_HOST_TO_DEVICE,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    SET_REPORT,
-					    OUT_REPORT_TYPE | FIRMWARE_REPORT_ID,
-					    0,
+	if (!fu_hpi_cfu_device_write_report(self,
+					    FIRMWARE_REPORT_ID,
 					    st_req->data,
 					    st_req->len,
-					    NULL,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
 					    &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
@@ -335,6 +687,51 @@ fu_hpi_cfu_send_offer_update_command(FuHpiCfuDevice *self, FuFirmware *fw_offer,
 	return TRUE;
 }
 
+/* an offer to the command component rather than to a firmware component */
+static gboolean
+fu_hpi_cfu_send_offer_command(FuHpiCfuDevice *self, FuHpiCfuOfferCommand command, GError **error)
+{
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GBytes) offer_command_request = NULL;
+
+	guint8 offer_command_buf[] = {0x25,
+				      command,
+				      0x00,
+				      0xfe,
+				      0xa0,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00,
+				      0x00};
+	offer_command_request = g_bytes_new(offer_command_buf, sizeof(offer_command_buf));
+	fu_dump_bytes(G_LOG_DOMAIN, "fu_hpi_cfu_send_offer_command sending:", offer_command_request);
+
+	if (!fu_hpi_cfu_device_write_report(self,
+					    OFFER_REPORT_ID,
+					    offer_command_buf,
+					    sizeof(offer_command_buf),
+					    &error_local)) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_NOT_SUPPORTED,
+			    "send_offer_command %s with error: %s",
+			    fu_hpi_cfu_offer_command_to_string(command),
+			    error_local->message);
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
 static gboolean
 fu_hpi_cfu_firmware_update_offer_accepted(FuHpiCfuDevice *self,
 					  FuHpiCfuDevicePrivate *priv,
@@ -346,14 +743,7 @@ fu_hpi_cfu_firmware_update_offer_accepted(FuHpiCfuDevice *self,
 	guint8 buf[128] = {0};
 	g_autoptr(GBytes) offer_response = NULL;
 	*reply = 0;
-	if (!fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
-					      END_POINT_ADDRESS,
-					      buf,
-					      sizeof(buf),
-					      &actual_length,
-					      FU_HPI_CFU_DEVICE_TIMEOUT,
-					      NULL,
-					      &error_local)) {
+	if (!fu_hpi_cfu_device_read_report(self, buf, sizeof(buf), &actual_length, &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
 			    FWUPD_ERROR_NOT_SUPPORTED,
@@ -375,6 +765,7 @@ fu_hpi_cfu_firmware_update_offer_accepted(FuHpiCfuDevice *self,
 		if (buf[13] == 0x02) {
 			g_debug("fu_hpi_cfu_firmware_update_offer_accepted:reason: %s",
 				fu_cfu_rr_code_to_string(buf[9]));
+			priv->telemetry.reject_reason = buf[9];
 		} else {
 			g_debug("fu_hpi_cfu_firmware_update_offer_accepted:reason: %s buf[13] is "
 				"not a reject.",
@@ -386,6 +777,25 @@ fu_hpi_cfu_firmware_update_offer_accepted(FuHpiCfuDevice *self,
 	return TRUE;
 }
 
+/* from the last report of a window to its ack */
+static void
+fu_hpi_cfu_device_telemetry_add_rtt(FuHpiCfuDeviceTelemetry *telemetry, gint64 rtt)
+{
+	if (telemetry->rtt_count == 0) {
+		telemetry->rtt_min = rtt;
+		telemetry->rtt_max = rtt;
+	} else {
+		/* smoothed difference between consecutive round trips */
+		gint64 delta = ABS(rtt - telemetry->rtt_last);
+		telemetry->rtt_jitter += ((gdouble)delta - telemetry->rtt_jitter) / 16;
+		telemetry->rtt_min = MIN(telemetry->rtt_min, rtt);
+		telemetry->rtt_max = MAX(telemetry->rtt_max, rtt);
+	}
+	telemetry->rtt_count++;
+	telemetry->rtt_last = rtt;
+	telemetry->rtt_mean += ((gdouble)rtt - telemetry->rtt_mean) / telemetry->rtt_count;
+}
+
 static gboolean
 fu_hpi_cfu_read_content_ack(FuHpiCfuDevicePrivate *priv,
 			    FuHpiCfuDevice *self,
@@ -398,21 +808,48 @@ fu_hpi_cfu_read_content_ack(FuHpiCfuDevicePrivate *priv,
 	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GBytes) read_ack_response = NULL;
 	gsize actual_length = 0;
+	gint32 seq_ack = -1;
 	guint8 buf[128];
 	*report_id = 0;
 	*status = 0;
 
-	g_debug("fu_hpi_cfu_read_content_ack at sequence_number:%d", priv->sequence_number);
-	if (!fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
-					      END_POINT_ADDRESS,
-					      buf,
-					      sizeof(buf),
-					      &actual_length,
-					      FU_HPI_CFU_DEVICE_TIMEOUT,
-					      NULL,
-					      &error_local)) {
-		return FALSE;
+	g_debug("fu_hpi_cfu_read_content_ack at sequence_number:%u", priv->sequence_number);
+	for (guint i = 0;; i++) {
+		guint16 seq;
+
+		if (!fu_hpi_cfu_device_read_report(self,
+						   buf,
+						   sizeof(buf),
+						   &actual_length,
+						   &error_local)) {
+			g_propagate_error(error, g_steal_pointer(&error_local));
+			return FALSE;
+		}
+
+		/* a successful ack for an earlier report would shift every later one, but
+		 * a failure is returned whichever report it is for */
+		if (buf[0] != CONTENT_ACK_REPORT_ID)
+			break;
+		seq = fu_memread_uint16(buf + 1, G_LITTLE_ENDIAN);
+		if (seq == (priv->sequence_number & G_MAXUINT16))
+			break;
+		if (buf[5] != FU_HPI_FIRMWARE_UPDATE_STATUS_SUCCESS) {
+			g_debug("error ack for sequence number %u", seq);
+			break;
+		}
+		if (i >= FU_HPI_CFU_DEVICE_ABORT_DRAIN) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_DATA,
+				    "ack out of sequence, got %u and expected %u",
+				    seq,
+				    priv->sequence_number & G_MAXUINT16);
+			return FALSE;
+		}
+		g_debug("discarding stale ack for sequence number %u", seq);
 	}
+	fu_hpi_cfu_device_telemetry_add_rtt(&priv->telemetry,
+					    g_get_monotonic_time() - priv->submit_time);
 	g_debug("fu_hpi_cfu_read_content_ack: bytes_received:%x", (guint)actual_length);
 	read_ack_response = g_bytes_new(buf, actual_length);
 	fu_dump_bytes(G_LOG_DOMAIN,
@@ -420,8 +857,26 @@ fu_hpi_cfu_read_content_ack(FuHpiCfuDevicePrivate *priv,
 		      read_ack_response);
 
 	*report_id = buf[0];
+	*reason = buf[9];
+
+	/* only a content ack has a sequence number, an offer reply has the reason there */
+	if (buf[0] == CONTENT_ACK_REPORT_ID)
+		seq_ack = fu_memread_uint16(buf + 1, G_LITTLE_ENDIAN);
+	FU_HPI_CFU_PROBE3(ack_received,
+			  seq_ack,
+			  buf[0],
+			  buf[0] == FIRMWARE_REPORT_ID ? buf[13] : buf[5]);
+	fu_hpi_cfu_recorder_add(priv->recorder,
+				FU_HPI_CFU_RECORDER_KIND_ACK,
+				buf[0],
+				buf[0] == FIRMWARE_REPORT_ID ? buf[13] : buf[5],
+				seq_ack,
+				0,
+				0);
 	/* success */
 	if (buf[0] == FIRMWARE_REPORT_ID) {
+		if (buf[13] == 0x02)
+			priv->telemetry.reject_reason = buf[9];
 		g_debug("status:%s response:%s",
 			fu_cfu_offer_status_to_string(buf[13]),
 			fu_cfu_rr_code_to_string(buf[9]));
@@ -439,6 +894,7 @@ fu_hpi_cfu_read_content_ack(FuHpiCfuDevicePrivate *priv,
 		g_debug("read_content_ack: buffer[5]: %02x, response:%s",
 			(guchar)buf[5],
 			fu_cfu_content_status_to_string(buf[5]));
+		priv->telemetry.content_status = buf[5];
 
 		if (buf[5] == 0x00) {
 			g_debug("read_content_ack:1");
@@ -496,18 +952,10 @@ fu_hpi_cfu_send_end_offer_list(FuHpiCfuDevice *self, GError **error)
 	end_offer_request = g_bytes_new(end_offer_list_buf, sizeof(end_offer_list_buf));
 	fu_dump_bytes(G_LOG_DOMAIN, "fu_hpi_cfu_send_end_offer_list sending:", end_offer_request);
 
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_HOST_TO_DEVICE,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    SET_REPORT,
-					    OUT_REPORT_TYPE | OFFER_REPORT_ID,
-					    0,
+	if (!fu_hpi_cfu_device_write_report(self,
+					    OFFER_REPORT_ID,
 					    end_offer_list_buf,
 					    sizeof(end_offer_list_buf),
-					    NULL,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
 					    &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
@@ -529,14 +977,7 @@ fu_hpi_cfu_end_offer_list_accepted(FuHpiCfuDevice *self, GError **error)
 	guint8 buf[128] = {0};
 	g_autoptr(GBytes) end_offer_response = NULL;
 
-	if (!fu_usb_device_interrupt_transfer(FU_USB_DEVICE(self),
-					      END_POINT_ADDRESS,
-					      buf,
-					      sizeof(buf),
-					      &actual_length,
-					      FU_HPI_CFU_DEVICE_TIMEOUT,
-					      NULL,
-					      &error_local)) {
+	if (!fu_hpi_cfu_device_read_report(self, buf, sizeof(buf), &actual_length, &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
 			    FWUPD_ERROR_NOT_SUPPORTED,
@@ -611,7 +1052,7 @@ fu_hpi_cfu_handler_start_entire_transaction_accepted(FuHpiCfuDevice *self,
 	}
 
 	priv->state = FU_HPI_CFU_STATE_START_OFFER_LIST;
-	fu_progress_step_done(progress); /* start-entire  */
+	fu_hpi_cfu_device_step_done(self, progress); /* start-entire  */
 
 	/* sucess */
 	return TRUE;
@@ -657,7 +1098,7 @@ fu_hpi_cfu_handler_send_start_offer_list_accepted(FuHpiCfuDevice *self,
 	else
 		priv->state = FU_HPI_CFU_STATE_UPDATE_STOP;
 
-	fu_progress_step_done(progress); /* offer-accept  */
+	fu_hpi_cfu_device_step_done(self, progress); /* offer-accept  */
 
 	/* sucess */
 	return TRUE;
@@ -676,7 +1117,10 @@ fu_hpi_cfu_handler_send_offer_update_command(FuHpiCfuDevice *self,
 
 	update_options = (FuHpiCfuHandlerOptions *)options;
 
-	if (!fu_hpi_cfu_send_offer_update_command(self, update_options->fw_offer, error)) {
+	if (!fu_hpi_cfu_send_offer_update_command(self,
+						  priv,
+						  fu_hpi_cfu_image_get_offer(update_options->image),
+						  error)) {
 		priv->state = FU_HPI_CFU_STATE_ERROR;
 		return FALSE;
 	} else
@@ -686,27 +1130,29 @@ fu_hpi_cfu_handler_send_offer_update_command(FuHpiCfuDevice *self,
 	return TRUE;
 }
 
-static gboolean
-fu_hpi_cfu_handler_send_offer_accepted(FuHpiCfuDevice *self,
-				       FuHpiCfuDevicePrivate *priv,
-				       FuProgress *progress,
-				       void *options,
-				       GError **error)
+static void
+fu_hpi_cfu_device_handle_offer_reply(FuHpiCfuDevicePrivate *priv,
+				     gint32 reply,
+				     FuHpiCfuState restart_state)
 {
-	gint32 reply = 0;
-
-	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
-
-	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error)) {
-		priv->state = FU_HPI_CFU_STATE_ERROR;
-		return FALSE;
-	}
+	fu_hpi_cfu_recorder_add(priv->recorder,
+				FU_HPI_CFU_RECORDER_KIND_OFFER,
+				reply,
+				reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT
+				    ? priv->telemetry.reject_reason
+				    : -1,
+				-1,
+				0,
+				0);
 	if (reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT) {
 		g_debug("fu_hpi_cfu_firmware_update_offer_accepted: reply:%d, offer accepted",
 			reply);
 		priv->sequence_number = 0;
-		priv->currentaddress = 0;
+		priv->bytes_sent = 0;
 		priv->last_packet_sent = 0;
+		priv->telemetry.transfer_start = g_get_monotonic_time();
+		priv->telemetry.handshake_time =
+		    priv->telemetry.transfer_start - priv->telemetry.start_time;
 		priv->state = FU_HPI_CFU_STATE_UPDATE_CONTENT;
 	} else {
 		if (reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_SKIP) {
@@ -718,12 +1164,19 @@ fu_hpi_cfu_handler_send_offer_accepted(FuHpiCfuDevice *self,
 			g_debug(
 			    "fu_hpi_cfu_firmware_update_offer_accepted: reply:%d, OFFER_REJECTED",
 			    reply);
+			FU_HPI_CFU_PROBE2(offer_reject,
+					  priv->sequence_number,
+					  priv->telemetry.reject_reason);
+			priv->bank_rejected =
+			    priv->telemetry.reject_reason == FU_HPI_CFU_FIRMWARE_OFFER_REJECT_BANK;
 			priv->state = FU_HPI_CFU_STATE_UPDATE_MORE_OFFERS;
 		} else if (reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_BUSY) {
 			g_debug("fu_hpi_cfu_firmware_update_offer_accepted: reply:%d, OFFER_BUSY",
 				reply);
 			priv->retry_attempts++;
-			priv->state = FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION;
+			priv->telemetry.busy_events++;
+			FU_HPI_CFU_PROBE2(offer_busy, priv->sequence_number, priv->retry_attempts);
+			priv->state = restart_state;
 
 			if (priv->retry_attempts > 3) {
 				priv->state = FU_HPI_CFU_STATE_NOTIFY_ON_READY;
@@ -731,13 +1184,33 @@ fu_hpi_cfu_handler_send_offer_accepted(FuHpiCfuDevice *self,
 					  "attempts.Restart "
 					  "the device(Reason: Device busy)");
 			} else
-				priv->state = FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION;
+				priv->state = restart_state;
 		} else {
 			priv->state = FU_HPI_CFU_STATE_UPDATE_MORE_OFFERS;
 		}
 	}
+}
+
+static gboolean
+fu_hpi_cfu_handler_send_offer_accepted(FuHpiCfuDevice *self,
+				       FuHpiCfuDevicePrivate *priv,
+				       FuProgress *progress,
+				       void *options,
+				       GError **error)
+{
+	gint32 reply = 0;
+
+	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
+
+	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error)) {
+		priv->state = FU_HPI_CFU_STATE_ERROR;
+		return FALSE;
+	}
+	fu_hpi_cfu_device_handle_offer_reply(priv,
+					     reply,
+					     FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION);
 
-	fu_progress_step_done(progress); /* send-offer */
+	fu_hpi_cfu_device_step_done(self, progress); /* send-offer */
 
 	/* sucess */
 	return TRUE;
@@ -746,125 +1219,43 @@ fu_hpi_cfu_handler_send_offer_accepted(FuHpiCfuDevice *self,
 static gboolean
 fu_hpi_cfu_send_payload(FuHpiCfuDevice *self,
 			FuHpiCfuDevicePrivate *priv,
-			GByteArray *cfu_buf,
+			GByteArray *st_req,
 			GError **error)
 {
 	g_autoptr(GBytes) fw_content_command = NULL;
-	g_autoptr(GByteArray) st_req = fu_struct_hpi_cfu_payload_cmd_new();
 	g_autoptr(GError) error_local = NULL;
 
-	fu_struct_hpi_cfu_payload_cmd_set_report_id(st_req, FIRMWARE_REPORT_ID);
-
 	priv->sequence_number++;
-
-	if (priv->sequence_number == 1) {
+	if (priv->sequence_number == 1)
 		g_debug("first packet setting the flag FU_CFU_CONTENT_FLAG_FIRST_BLOCK");
-		fu_struct_hpi_cfu_payload_cmd_set_flags(st_req, FU_CFU_CONTENT_FLAG_FIRST_BLOCK);
-	}
-
-	if (priv->last_packet_sent) {
+	if (priv->last_packet_sent)
 		g_debug("last packet setting the flag FU_CFU_CONTENT_FLAG_LAST_BLOCK");
-		fu_struct_hpi_cfu_payload_cmd_set_flags(st_req, FU_CFU_CONTENT_FLAG_LAST_BLOCK);
-	}
-
-	fu_struct_hpi_cfu_payload_cmd_set_length(st_req, cfu_buf->len);
-	fu_struct_hpi_cfu_payload_cmd_set_seq_number(st_req, priv->sequence_number);
-	fu_struct_hpi_cfu_payload_cmd_set_address(st_req, priv->currentaddress);
 
-	if (!fu_struct_hpi_cfu_payload_cmd_set_data(st_req, cfu_buf->data, cfu_buf->len, error)) {
-		return FALSE;
-	}
-
-	priv->currentaddress += cfu_buf->len;
-	priv->bytes_sent += cfu_buf->len;
-	priv->bytes_remaining = priv->payload_file_size - (priv->bytes_sent + 5);
+	priv->bytes_sent += fu_struct_hpi_cfu_payload_cmd_get_length(st_req);
 
 	fw_content_command = g_bytes_new(st_req->data, st_req->len);
 	fu_dump_bytes(G_LOG_DOMAIN, "bytes sending to device", fw_content_command);
-
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_HOST_TO_DEVICE,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    SET_REPORT,
-					    OUT_REPORT_TYPE | FIRMWARE_REPORT_ID,
-					    0,
+	FU_HPI_CFU_PROBE3(report_submit,
+			  fu_struct_hpi_cfu_payload_cmd_get_seq_number(st_req),
+			  fu_struct_hpi_cfu_payload_cmd_get_address(st_req),
+			  fu_struct_hpi_cfu_payload_cmd_get_length(st_req));
+	fu_hpi_cfu_recorder_add(priv->recorder,
+				FU_HPI_CFU_RECORDER_KIND_SUBMIT,
+				0,
+				0,
+				fu_struct_hpi_cfu_payload_cmd_get_seq_number(st_req),
+				fu_struct_hpi_cfu_payload_cmd_get_address(st_req),
+				fu_struct_hpi_cfu_payload_cmd_get_length(st_req));
+
+	if (!fu_hpi_cfu_device_write_report(self,
+					    FIRMWARE_REPORT_ID,
 					    st_req->data,
 					    st_req->len,
-					    NULL,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
 					    &error_local)) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
 		return FALSE;
 	}
-
-	return TRUE;
-}
-
-static gboolean
-fu_hpi_cfu_untransmitted_data(GByteArray *payload_data,
-			      GByteArray *untransmitted_data,
-			      guint32 payload_header_length,
-			      guint32 fill_from_position,
-			      GError **error)
-{
-	guint32 remaining_byte_count = 0;
-	remaining_byte_count = payload_header_length - fill_from_position;
-
-	fu_byte_array_set_size(untransmitted_data, remaining_byte_count, 0x00);
-
-	if (!fu_memcpy_safe(untransmitted_data->data,
-			    remaining_byte_count,
-			    0x0,
-			    payload_data->data + fill_from_position,
-			    remaining_byte_count,
-			    0x0,
-			    remaining_byte_count,
-			    error))
-		return FALSE;
-
-	return TRUE;
-}
-
-static gboolean
-fu_hpi_cfu_get_payload_header(GByteArray *payload_header,
-			      GByteArray *payload_buf,
-			      guint32 read_index,
-			      GError **error)
-{
-	fu_byte_array_set_size(payload_header, 5, 0x00);
-
-	if (!fu_memcpy_safe(payload_header->data,
-			    payload_header->len,
-			    0x0,
-			    payload_buf->data + read_index,
-			    5,
-			    0x0,
-			    5,
-			    error))
-		return FALSE;
-
-	return TRUE;
-}
-
-static gboolean
-fu_hpi_cfu_get_payload_data(GByteArray *payload_data,
-			    GByteArray *payload_buf,
-			    guint32 payload_header_length,
-			    guint32 read_index,
-			    GError **error)
-{
-	fu_byte_array_set_size(payload_data, payload_header_length, 0x00);
-
-	if (!fu_memcpy_safe(payload_data->data,
-			    payload_data->len,
-			    0x0,
-			    payload_buf->data + read_index + 5,
-			    payload_header_length,
-			    0x0,
-			    payload_header_length,
-			    error))
-		return FALSE;
+	priv->submit_time = g_get_monotonic_time();
 
 	return TRUE;
 }
@@ -989,6 +1380,7 @@ fu_hpi_cfu_handler_check_update_content(FuHpiCfuDevice *self,
 			case FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT:
 				g_warning("fu_hpi_cfu_handler_check_update_content: "
 					  "FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECTED");
+				FU_HPI_CFU_PROBE2(offer_reject, priv->sequence_number, reason);
 
 				priv->state = FU_HPI_CFU_STATE_UPDATE_MORE_OFFERS;
 				break;
@@ -996,6 +1388,10 @@ fu_hpi_cfu_handler_check_update_content(FuHpiCfuDevice *self,
 			case FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_BUSY:
 				g_warning("fu_hpi_cfu_handler_check_update_content: "
 					  "FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_BUSY");
+				priv->telemetry.busy_events++;
+				FU_HPI_CFU_PROBE2(offer_busy,
+						  priv->sequence_number,
+						  priv->retry_attempts);
 				priv->state = FU_HPI_CFU_STATE_NOTIFY_ON_READY;
 				break;
 
@@ -1055,305 +1451,76 @@ fu_hpi_cfu_handler_check_update_content(FuHpiCfuDevice *self,
 	return TRUE;
 }
 
+/* wait until the average rate since the offer was accepted, acks included, is under the limit;
+ * a slow limit means long waits, so this wakes up as soon as the update is cancelled */
 static gboolean
-fu_hpi_cfu_handler_send_payload(FuHpiCfuDevice *self,
-				FuHpiCfuDevicePrivate *priv,
-				FuProgress *progress,
+fu_hpi_cfu_device_throttle(FuHpiCfuDevicePrivate *priv, GError **error)
+{
+	gint64 elapsed;
+	gint64 expected;
+	GPollFD pollfd = {.events = G_IO_IN};
+
+	if (priv->max_transfer_rate == 0)
+		return TRUE;
+	expected = (gint64)(priv->bytes_sent * G_USEC_PER_SEC / priv->max_transfer_rate);
+	elapsed = g_get_monotonic_time() - priv->telemetry.transfer_start;
+	if (expected <= elapsed)
+		return TRUE;
+	pollfd.fd = g_cancellable_get_fd(priv->cancellable);
+	if (pollfd.fd < 0) {
+		g_usleep(expected - elapsed);
+	} else {
+		g_poll(&pollfd, 1, (expected - elapsed + 999) / 1000);
+		g_cancellable_release_fd(priv->cancellable);
+	}
+	return !g_cancellable_set_error_if_cancelled(priv->cancellable, error);
+}
+
+static gboolean
+fu_hpi_cfu_handler_send_payload(FuHpiCfuDevice *self,
+				FuHpiCfuDevicePrivate *priv,
+				FuProgress *progress,
 				void *options,
 				GError **error)
 {
-	g_autoptr(GPtrArray) chunks = NULL;
 	FuHpiCfuHandlerOptions *update_options = NULL;
+	GPtrArray *reports;
 
 	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
 
 	update_options = (FuHpiCfuHandlerOptions *)options;
 
-	chunks = fu_firmware_get_chunks(update_options->fw_payload, error);
-	if (chunks == NULL) {
-		g_set_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_DATA, "payload chunks is NULL");
+	/* the reports were built while the offer was being accepted */
+	if (!fu_hpi_cfu_device_ensure_reports(priv, error))
 		return FALSE;
-	}
-
-	for (guint32 i = 0; i < chunks->len; i++) {
-		FuChunk *chk = g_ptr_array_index(chunks, i);
-		g_autoptr(GByteArray) payload_buf = g_byte_array_new();
-		g_autoptr(GByteArray) untransmitted_data = g_byte_array_new();
-
-		g_byte_array_append(payload_buf, fu_chunk_get_data(chk), fu_chunk_get_data_sz(chk));
-
-		for (guint32 read_index = 0; read_index < payload_buf->len;) {
-			g_autoptr(GByteArray) payload_header = g_byte_array_new();
-			g_autoptr(GByteArray) payload_data = g_byte_array_new();
-			g_autoptr(GByteArray) cfu_data = g_byte_array_new();
-			guint32 payload_header_length = 0;
-			guint32 remaining_byte_count = 0;
-			guint32 fill_from_position = 0;
-
-			/* payload header */
-			if (!fu_hpi_cfu_get_payload_header(payload_header,
-							   payload_buf,
-							   read_index,
-							   error)) {
-				g_set_error(error,
-					    FWUPD_ERROR,
-					    FWUPD_ERROR_INVALID_DATA,
-					    "failed to get payload header");
-				return FALSE;
-			}
-
-			payload_header_length = (gint8)payload_header->data[4];
-
-			/* payload data */
-			if (!fu_hpi_cfu_get_payload_data(payload_data,
-							 payload_buf,
-							 payload_header_length,
-							 read_index,
-							 error)) {
-				g_set_error(error,
-					    FWUPD_ERROR,
-					    FWUPD_ERROR_INVALID_DATA,
-					    "failed to get payload data");
-				return FALSE;
-			}
-
-			read_index = read_index + payload_header_length + 5;
-			priv->last_packet_sent = (read_index >= payload_buf->len) ? 1 : 0;
-
-			/* send payload with existing untransmitted_data */
-			if (untransmitted_data->data != NULL) {
-				if (untransmitted_data->len >= FU_HPI_CFU_PAYLOAD_LENGTH) {
-					/* cfu_data to be sent to device */
-					g_byte_array_append(cfu_data,
-							    untransmitted_data->data,
-							    FU_HPI_CFU_PAYLOAD_LENGTH);
-					if (!fu_hpi_cfu_send_payload(self, priv, cfu_data, error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload at "
-							    "sequence number:%d",
-							    priv->sequence_number);
-						return FALSE;
-					}
-
-					remaining_byte_count =
-					    untransmitted_data->len - FU_HPI_CFU_PAYLOAD_LENGTH;
-					fill_from_position =
-					    untransmitted_data->len - remaining_byte_count;
-
-					if (remaining_byte_count) {
-						g_autoptr(GByteArray) untransmitted_remain =
-						    g_byte_array_new();
-
-						/* store the untransmitted_data remaining data */
-						if (!fu_hpi_cfu_untransmitted_data(
-							untransmitted_data,
-							untransmitted_remain,
-							untransmitted_data->len,
-							fill_from_position,
-							error)) {
-							g_set_error(
-							    error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload to "
-							    "set untransmitted_data");
-							return FALSE;
-						}
-					}
-				} else {
-					/* append untransmitted_data first */
-					g_byte_array_append(cfu_data,
-							    untransmitted_data->data,
-							    untransmitted_data->len);
-
-					fill_from_position =
-					    FU_HPI_CFU_PAYLOAD_LENGTH - untransmitted_data->len;
-					remaining_byte_count =
-					    payload_header_length - fill_from_position;
-
-					/* Now, append actual payload_data */
-					g_byte_array_append(cfu_data,
-							    payload_data->data,
-							    fill_from_position);
-
-					if (!fu_hpi_cfu_send_payload(self, priv, cfu_data, error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload for "
-							    "sequence number:%d",
-							    priv->sequence_number);
-						return FALSE;
-					}
-
-					if (remaining_byte_count >= FU_HPI_CFU_PAYLOAD_LENGTH) {
-						g_autoptr(GByteArray) cfu_data_remain =
-						    g_byte_array_new();
-
-						/* append remaining payload_data first */
-						g_byte_array_append(cfu_data_remain,
-								    payload_data->data +
-									fill_from_position,
-								    FU_HPI_CFU_PAYLOAD_LENGTH);
-
-						if (!fu_hpi_cfu_send_payload(self,
-									     priv,
-									     cfu_data_remain,
-									     error)) {
-							g_set_error(
-							    error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload "
-							    "for sequence number:%d",
-							    priv->sequence_number);
-							return FALSE;
-						}
-
-						remaining_byte_count = remaining_byte_count -
-								       FU_HPI_CFU_PAYLOAD_LENGTH;
-						fill_from_position =
-						    payload_header_length - remaining_byte_count;
-
-						/* store the untransmitted_data */
-						if (!fu_hpi_cfu_untransmitted_data(
-							payload_data,
-							untransmitted_data,
-							payload_header_length,
-							fill_from_position,
-							error)) {
-							g_set_error(
-							    error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload to "
-							    "set untransmitted_data");
-							return FALSE;
-						}
-					} else {
-						/* store the untransmitted_data */
-						if (!fu_hpi_cfu_untransmitted_data(
-							payload_data,
-							untransmitted_data,
-							payload_header_length,
-							fill_from_position,
-							error)) {
-							g_set_error(
-							    error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload to "
-							    "set untransmitted_data");
-							return FALSE;
-						}
-					}
-				}
-			} else {
-				if (payload_header_length > FU_HPI_CFU_PAYLOAD_LENGTH) {
-					/* cfu_data to be sent to device */
-					g_byte_array_append(cfu_data,
-							    payload_data->data,
-							    FU_HPI_CFU_PAYLOAD_LENGTH);
-
-					if (!fu_hpi_cfu_send_payload(self, priv, cfu_data, error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload for "
-							    "sequence number:%d",
-							    priv->sequence_number);
-						return FALSE;
-					}
-
-					remaining_byte_count =
-					    payload_header_length - FU_HPI_CFU_PAYLOAD_LENGTH;
-					fill_from_position =
-					    payload_header_length - remaining_byte_count;
-
-					/* store the remaining bytes to untransmitted_data */
-					if (!fu_hpi_cfu_untransmitted_data(payload_data,
-									   untransmitted_data,
-									   payload_header_length,
-									   fill_from_position,
-									   error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload to "
-							    "set untransmitted_data");
-						return FALSE;
-					}
-				} else {
-					/* cfu_data to be sent to device */
-					g_byte_array_append(cfu_data,
-							    payload_data->data,
-							    payload_data->len);
-
-					if (!fu_hpi_cfu_send_payload(self, priv, cfu_data, error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload for "
-							    "sequence number:%d",
-							    priv->sequence_number);
-						return FALSE;
-					}
-				}
-			}
-
-			if (priv->last_packet_sent) {
-				if (untransmitted_data->data != NULL) {
-					g_autoptr(GByteArray) cfu_last_packet = g_byte_array_new();
-
-					/* clear and assign the latest untransmitted_data */
-					fu_byte_array_set_size(cfu_last_packet,
-							       untransmitted_data->len,
-							       0x00);
-					if (!fu_memcpy_safe(cfu_last_packet->data,
-							    untransmitted_data->len,
-							    0x0,
-							    untransmitted_data->data,
-							    untransmitted_data->len,
-							    0x0,
-							    untransmitted_data->len,
-							    error))
-						return FALSE;
-
-					g_debug("sending payload last packet");
-					if (!fu_hpi_cfu_send_payload(self,
-								     priv,
-								     cfu_last_packet,
-								     error)) {
-						g_set_error(error,
-							    FWUPD_ERROR,
-							    FWUPD_ERROR_INVALID_DATA,
-							    "fu_hpi_cfu_handler_send_payload for "
-							    "sequence number:%d",
-							    priv->sequence_number);
-						return FALSE;
-					}
-				}
-			}
-
-			if (!fu_hpi_cfu_handler_check_update_content(self,
-								     priv,
-								     progress,
-								     options,
-								     error)) {
-				g_set_error(error,
-					    FWUPD_ERROR,
-					    FWUPD_ERROR_INVALID_DATA,
-					    "failed fu_hpi_cfu_handler_check_update_content for "
-					    "sequence_number:%d",
-					    priv->sequence_number);
-				return FALSE;
-			}
+	reports = fu_hpi_cfu_image_get_reports(update_options->image);
+	for (guint i = priv->sequence_number; i < reports->len; i++) {
+		GByteArray *st_req = g_ptr_array_index(reports, i);
+
+		priv->last_packet_sent = (i == reports->len - 1) ? 1 : 0;
+		if (!fu_hpi_cfu_send_payload(self, priv, st_req, error)) {
+			g_prefix_error(error,
+				       "fu_hpi_cfu_handler_send_payload for sequence number:%u: ",
+				       priv->sequence_number);
+			return FALSE;
+		}
 
-			if (priv->state != FU_HPI_CFU_STATE_UPDATE_CONTENT)
-				break;
+		if (!fu_hpi_cfu_handler_check_update_content(self,
+							     priv,
+							     progress,
+							     options,
+							     error)) {
+			g_prefix_error(error,
+				       "failed fu_hpi_cfu_handler_check_update_content for "
+				       "sequence_number:%u: ",
+				       priv->sequence_number);
+			return FALSE;
 		}
+		if (!fu_hpi_cfu_device_throttle(priv, error))
+			return FALSE;
+
+		if (priv->state != FU_HPI_CFU_STATE_UPDATE_CONTENT)
+			break;
 	}
 
 	return TRUE;
@@ -1369,6 +1536,8 @@ fu_hpi_cfu_handler_update_success(FuHpiCfuDevice *self,
 	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
 
 	if (priv->last_packet_sent) {
+		priv->telemetry.transfer_time =
+		    g_get_monotonic_time() - priv->telemetry.transfer_start;
 		priv->firmware_status = TRUE;
 		priv->state = FU_HPI_CFU_STATE_END_OFFER_LIST;
 	} else
@@ -1401,12 +1570,28 @@ fu_hpi_cfu_handler_update_more_offers(FuHpiCfuDevice *self,
 				      void *options,
 				      GError **error)
 {
+	FuHpiCfuHandlerOptions *update_options = (FuHpiCfuHandlerOptions *)options;
+
 	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
 
-	if (priv->last_packet_sent)
-		priv->state = FU_HPI_CFU_STATE_END_OFFER_LIST;
-	else
+	/* a dual-bank dock rejects the image linked for the bank it is running from, so
+	 * offer the one for the other bank in the same offer list */
+	if (priv->bank_rejected && update_options->image_alternate != NULL &&
+	    update_options->image != update_options->image_alternate) {
+		g_info("offer rejected for the bank, offering %s", priv->image_alternate_prefix);
+		if (!fu_hpi_cfu_image_packetize(update_options->image_alternate, error)) {
+			priv->state = FU_HPI_CFU_STATE_ERROR;
+			return FALSE;
+		}
+		update_options->image = update_options->image_alternate;
+		priv->telemetry.image_size =
+		    fu_hpi_cfu_image_get_payload_size(update_options->image);
 		priv->state = FU_HPI_CFU_STATE_UPDATE_OFFER;
+		return TRUE;
+	}
+
+	/* nothing else to offer, so sending it again gets the same reply */
+	priv->state = FU_HPI_CFU_STATE_END_OFFER_LIST;
 
 	return TRUE;
 }
@@ -1442,11 +1627,194 @@ fu_hpi_cfu_handler_end_offer_list_accepted(FuHpiCfuDevice *self,
 		return FALSE;
 	}
 
+	/* nothing was written, e.g. the dock already runs this version */
+	if (!priv->firmware_status) {
+		g_info("offer not accepted, nothing to verify");
+		priv->state = FU_HPI_CFU_STATE_UPDATE_STOP;
+		return TRUE;
+	}
+
 	priv->state = FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_BY_SENDING_OFFER_LIST_AGAIN;
 
 	return TRUE;
 }
 
+/* returns the number of reports that were waiting to be read */
+static guint
+fu_hpi_cfu_device_drain(FuHpiCfuDevice *self, guint timeout)
+{
+	for (guint i = 0; i < FU_HPI_CFU_DEVICE_ABORT_DRAIN; i++) {
+		gsize actual_length = 0;
+		guint8 buf[128] = {0};
+		g_autoptr(GError) error_local = NULL;
+		if (!fu_hpi_cfu_device_read_report_full(self,
+							buf,
+							sizeof(buf),
+							&actual_length,
+							timeout,
+							NULL,
+							&error_local)) {
+			g_debug("drained %u reports: %s", i, error_local->message);
+			return i;
+		}
+	}
+	return FU_HPI_CFU_DEVICE_ABORT_DRAIN;
+}
+
+/*
+ * Leaves the dock ready for the next attempt rather than stuck mid-transaction: the offer
+ * list is closed and, if the dock does not simply accept that, any replies still queued are
+ * thrown away and the version report is read back to confirm the dock is listening again.
+ *
+ * This deliberately ignores the cancellable, as a cancelled update still has to be closed.
+ */
+static gboolean
+fu_hpi_cfu_device_abort(FuHpiCfuDevice *self, GError **error)
+{
+	gsize actual_length = 0;
+	guint8 buf[128] = {0};
+	guint8 end_offer_list_buf[] = {0x25, 0x02, 0x00, 0xff, 0xa0, 0x00, 0x00, 0x00, 0x00,
+				       0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	g_autoptr(GError) error_local = NULL;
+
+	g_debug("aborting transaction");
+	if (!fu_hpi_cfu_device_write_report_full(self,
+						 OFFER_REPORT_ID,
+						 end_offer_list_buf,
+						 sizeof(end_offer_list_buf),
+						 FU_HPI_CFU_DEVICE_ABORT_TIMEOUT,
+						 NULL,
+						 error)) {
+		g_prefix_error(error, "failed to end offer list: ");
+		return FALSE;
+	}
+
+	/* an idle dock just accepts the end of the offer list */
+	if (fu_hpi_cfu_device_read_report_full(self,
+					       buf,
+					       sizeof(buf),
+					       &actual_length,
+					       FU_HPI_CFU_DEVICE_ABORT_TIMEOUT,
+					       NULL,
+					       &error_local)) {
+		if (actual_length > 13 && buf[0] == OFFER_REPORT_ID &&
+		    buf[13] == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT)
+			return TRUE;
+		g_debug("unexpected end-offer-list reply 0x%02x:0x%02x",
+			buf[0],
+			actual_length > 13 ? buf[13] : 0x0);
+	} else {
+		g_debug("no end-offer-list reply: %s", error_local->message);
+	}
+
+	/* anything else still queued */
+	fu_hpi_cfu_device_drain(self, FU_HPI_CFU_DEVICE_ABORT_TIMEOUT);
+
+	/* idle again */
+	if (!fu_hpi_cfu_device_read_version_report(self,
+						   buf,
+						   60,
+						   &actual_length,
+						   FU_HPI_CFU_DEVICE_ABORT_TIMEOUT,
+						   error)) {
+		g_prefix_error(error, "dock did not return to idle: ");
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gint
+fu_hpi_cfu_device_flight_record_sort_cb(gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* every failed update adds a file, so only keep the most recent */
+static void
+fu_hpi_cfu_device_prune_flight_records(const gchar *dirname)
+{
+	g_autoptr(GPtrArray) filenames = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	filenames = fu_path_glob(dirname, "flight-*.txt", &error_local);
+	if (filenames == NULL) {
+		g_debug("no flight records: %s", error_local->message);
+		return;
+	}
+	g_ptr_array_sort(filenames, fu_hpi_cfu_device_flight_record_sort_cb);
+	for (guint i = 0; i + FU_HPI_CFU_DEVICE_FLIGHT_RECORDS_MAX < filenames->len; i++) {
+		const gchar *filename = g_ptr_array_index(filenames, i);
+		g_autoptr(GError) error_delete = NULL;
+		g_autoptr(GFile) file = g_file_new_for_path(filename);
+
+		if (!g_file_delete(file, NULL, &error_delete))
+			g_warning("failed to delete %s: %s", filename, error_delete->message);
+	}
+}
+
+/* the recent history of a failed update, as debug logging is normally off */
+static void
+fu_hpi_cfu_device_save_flight_record(FuHpiCfuDevice *self)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *dirname = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *localstatedir = fu_path_from_kind(FU_PATH_KIND_LOCALSTATEDIR_PKG);
+	g_autofree gchar *str = fu_hpi_cfu_recorder_to_string(priv->recorder);
+	g_autofree gchar *timestamp = NULL;
+	g_autoptr(GDateTime) dt = g_date_time_new_now_utc();
+	g_autoptr(GError) error_local = NULL;
+
+	/* the timestamp first, so the names sort oldest first */
+	timestamp = g_date_time_format(dt, "%Y%m%d-%H%M%S");
+	basename = g_strdup_printf("flight-%s-%03u-%03u.txt",
+				   timestamp,
+				   fu_usb_device_get_bus(FU_USB_DEVICE(self)),
+				   fu_usb_device_get_address(FU_USB_DEVICE(self)));
+	dirname = g_build_filename(localstatedir, "hpi-cfu", NULL);
+	filename = g_build_filename(dirname, basename, NULL);
+	if (!fu_path_mkdir_parent(filename, &error_local) ||
+	    !g_file_set_contents(filename, str, -1, &error_local)) {
+		g_warning("failed to save flight record: %s", error_local->message);
+		return;
+	}
+	g_info("update failed, recent events saved to %s", filename);
+	fu_hpi_cfu_device_prune_flight_records(dirname);
+}
+
+/*
+ * A reply still queued from an earlier session, e.g. after the daemon was killed part way
+ * through, would be taken as the reply to the first command of this one. The dock may also
+ * still be in that transaction without anything queued, e.g. when it was waiting for the
+ * next content report, so the offer list is always closed and the version report read back
+ * before starting again.
+ */
+static gboolean
+fu_hpi_cfu_device_resync(FuHpiCfuDevice *self, GError **error)
+{
+	guint stale = fu_hpi_cfu_device_drain(self, FU_HPI_CFU_DEVICE_RESYNC_TIMEOUT);
+	if (stale > 0)
+		g_info("discarded %u stale reports from an earlier transaction", stale);
+	if (!fu_hpi_cfu_device_abort(self, error)) {
+		g_prefix_error(error, "failed to resynchronize: ");
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static void
+fu_hpi_cfu_device_abort_or_warn(FuHpiCfuDevice *self)
+{
+	g_autoptr(GError) error_local = NULL;
+	if (!fu_hpi_cfu_device_abort(self, &error_local))
+		g_warning("failed to abort, dock may need a power cycle: %s", error_local->message);
+}
+
 static gboolean
 fu_hpi_cfu_handler_update_stop(FuHpiCfuDevice *self,
 			       FuHpiCfuDevicePrivate *priv,
@@ -1458,7 +1826,7 @@ fu_hpi_cfu_handler_update_stop(FuHpiCfuDevice *self,
 
 	priv->exit_state_machine_framework = TRUE;
 
-	fu_progress_step_done(progress); /* send-payload */
+	fu_hpi_cfu_device_step_done(self, progress); /* send-payload */
 
 	return TRUE;
 }
@@ -1472,6 +1840,8 @@ fu_hpi_cfu_handler_error(FuHpiCfuDevice *self,
 {
 	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
 
+	fu_hpi_cfu_device_save_flight_record(self);
+	fu_hpi_cfu_device_abort_or_warn(self);
 	priv->state = FU_HPI_CFU_STATE_UPDATE_STOP;
 
 	return TRUE;
@@ -1561,7 +1931,10 @@ fu_hpi_cfu_handler_swap_pending_send_offer_again(FuHpiCfuDevice *self,
 
 	update_options = (FuHpiCfuHandlerOptions *)options;
 
-	if (!fu_hpi_cfu_send_offer_update_command(self, update_options->fw_offer, error)) {
+	if (!fu_hpi_cfu_send_offer_update_command(self,
+						  priv,
+						  fu_hpi_cfu_image_get_offer(update_options->image),
+						  error)) {
 		priv->state = FU_HPI_CFU_STATE_ERROR;
 		return FALSE;
 	} else
@@ -1586,6 +1959,9 @@ fu_hpi_cfu_handler_swap_pending_send_offer_list_accepted(FuHpiCfuDevice *self,
 	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error)) {
 		return FALSE;
 	}
+	reason = priv->telemetry.reject_reason;
+	priv->swap_pending = reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT &&
+			     reason == FU_HPI_CFU_FIRMWARE_OFFER_REJECT_SWAP_PENDING;
 
 	g_debug("fu_hpi_cfu_handler_swap_pending_send_offer_list_accepted: reply:%d", reply);
 
@@ -1685,7 +2061,7 @@ fu_hpi_cfu_handler_send_end_offer_list(FuHpiCfuDevice *self,
 
 	priv->state = FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_UPDATE_END_OFFER_LIST_ACCEPTED;
 
-	fu_progress_step_done(progress); /* send-payload */
+	fu_hpi_cfu_device_step_done(self, progress); /* send-payload */
 
 	return TRUE;
 }
@@ -1717,61 +2093,195 @@ fu_hpi_cfu_handler_verify_error(FuHpiCfuDevice *self,
 {
 	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
 
+	fu_hpi_cfu_device_save_flight_record(self);
+	fu_hpi_cfu_device_abort_or_warn(self);
 	priv->state = FU_HPI_CFU_STATE_UPDATE_STOP;
 
 	return TRUE;
 }
 
+/*
+ * The dock queues the start-entire-transaction, start-offer-list and offer commands, so
+ * they can be sent back-to-back and the three replies read afterwards in the same order.
+ */
+static gboolean
+fu_hpi_cfu_handler_pipelined_handshake(FuHpiCfuDevice *self,
+				       FuHpiCfuDevicePrivate *priv,
+				       FuProgress *progress,
+				       void *options,
+				       GError **error)
+{
+	FuHpiCfuHandlerOptions *update_options = (FuHpiCfuHandlerOptions *)options;
+	gint32 status = 0;
+	gint32 reply = 0;
+
+	g_debug("hpi-cfu-state: %s", fu_hpi_cfu_state_to_string(priv->state));
+
+	/* send everything first */
+	if (!fu_hpi_cfu_start_entire_transaction(self, error) ||
+	    !fu_hpi_cfu_send_start_offer_list(self, error) ||
+	    !fu_hpi_cfu_send_offer_update_command(self,
+						  priv,
+						  fu_hpi_cfu_image_get_offer(update_options->image),
+						  error)) {
+		priv->state = FU_HPI_CFU_STATE_ERROR;
+		return FALSE;
+	}
+
+	/* then the replies */
+	if (!fu_hpi_cfu_start_entire_transaction_accepted(self, priv, error)) {
+		priv->state = FU_HPI_CFU_STATE_ERROR;
+		return FALSE;
+	}
+	if (priv->state == FU_HPI_CFU_STATE_ERROR) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_NOT_SUPPORTED,
+				    "start entire transaction not accepted");
+		return FALSE;
+	}
+	fu_hpi_cfu_device_step_done(self, progress); /* start-entire */
+	if (!fu_hpi_cfu_send_offer_list_accepted(self, &status, error)) {
+		priv->state = FU_HPI_CFU_STATE_ERROR;
+		return FALSE;
+	}
+	fu_hpi_cfu_device_step_done(self, progress); /* start-offer */
+	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error)) {
+		priv->state = FU_HPI_CFU_STATE_ERROR;
+		return FALSE;
+	}
+	fu_hpi_cfu_device_handle_offer_reply(priv, reply, FU_HPI_CFU_STATE_PIPELINED_HANDSHAKE);
+	fu_hpi_cfu_device_step_done(self, progress); /* send-offer */
+
+	/* success */
+	return TRUE;
+}
+
 FuHpiCfuStateMachineFramework hpi_cfu_states[] = {
-    {FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION, fu_hpi_cfu_handler_start_entire_transaction, NULL},
+    {FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION, fu_hpi_cfu_handler_start_entire_transaction},
     {FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION_ACCEPTED,
-     fu_hpi_cfu_handler_start_entire_transaction_accepted,
-     NULL},
-    {FU_HPI_CFU_STATE_START_OFFER_LIST, fu_hpi_cfu_handler_send_start_offer_list, NULL},
-    {FU_HPI_CFU_STATE_START_OFFER_LIST_ACCEPTED,
-     fu_hpi_cfu_handler_send_start_offer_list_accepted,
-     NULL},
-    {FU_HPI_CFU_STATE_UPDATE_OFFER, fu_hpi_cfu_handler_send_offer_update_command, &handler_options},
-    {FU_HPI_CFU_STATE_UPDATE_OFFER_ACCEPTED, fu_hpi_cfu_handler_send_offer_accepted, NULL},
-    {FU_HPI_CFU_STATE_UPDATE_CONTENT, fu_hpi_cfu_handler_send_payload, &handler_options},
-    {FU_HPI_CFU_STATE_UPDATE_SUCCESS, fu_hpi_cfu_handler_update_success, NULL},
-    {FU_HPI_CFU_STATE_UPDATE_OFFER_REJECTED, fu_hpi_cfu_handler_update_offer_rejected, NULL},
-    {FU_HPI_CFU_STATE_UPDATE_MORE_OFFERS, fu_hpi_cfu_handler_update_more_offers, NULL},
-    {FU_HPI_CFU_STATE_END_OFFER_LIST, fu_hpi_cfu_handler_end_offer_list, NULL},
-    {FU_HPI_CFU_STATE_END_OFFER_LIST_ACCEPTED, fu_hpi_cfu_handler_end_offer_list_accepted, NULL},
-    {FU_HPI_CFU_STATE_UPDATE_STOP, fu_hpi_cfu_handler_update_stop, NULL},
-    {FU_HPI_CFU_STATE_ERROR, fu_hpi_cfu_handler_error, NULL},
-    {FU_HPI_CFU_STATE_CHECK_UPDATE_CONTENT, fu_hpi_cfu_handler_check_update_content, NULL},
-    {FU_HPI_CFU_STATE_NOTIFY_ON_READY, fu_hpi_cfu_handler_notify_on_ready, NULL},
-    {FU_HPI_CFU_STATE_WAIT_FOR_READY_NOTIFICATION,
-     fu_hpi_cfu_handler_wait_for_ready_notification,
-     NULL},
+     fu_hpi_cfu_handler_start_entire_transaction_accepted},
+    {FU_HPI_CFU_STATE_START_OFFER_LIST, fu_hpi_cfu_handler_send_start_offer_list},
+    {FU_HPI_CFU_STATE_START_OFFER_LIST_ACCEPTED, fu_hpi_cfu_handler_send_start_offer_list_accepted},
+    {FU_HPI_CFU_STATE_UPDATE_OFFER, fu_hpi_cfu_handler_send_offer_update_command},
+    {FU_HPI_CFU_STATE_UPDATE_OFFER_ACCEPTED, fu_hpi_cfu_handler_send_offer_accepted},
+    {FU_HPI_CFU_STATE_UPDATE_CONTENT, fu_hpi_cfu_handler_send_payload},
+    {FU_HPI_CFU_STATE_UPDATE_SUCCESS, fu_hpi_cfu_handler_update_success},
+    {FU_HPI_CFU_STATE_UPDATE_OFFER_REJECTED, fu_hpi_cfu_handler_update_offer_rejected},
+    {FU_HPI_CFU_STATE_UPDATE_MORE_OFFERS, fu_hpi_cfu_handler_update_more_offers},
+    {FU_HPI_CFU_STATE_END_OFFER_LIST, fu_hpi_cfu_handler_end_offer_list},
+    {FU_HPI_CFU_STATE_END_OFFER_LIST_ACCEPTED, fu_hpi_cfu_handler_end_offer_list_accepted},
+    {FU_HPI_CFU_STATE_UPDATE_STOP, fu_hpi_cfu_handler_update_stop},
+    {FU_HPI_CFU_STATE_ERROR, fu_hpi_cfu_handler_error},
+    {FU_HPI_CFU_STATE_CHECK_UPDATE_CONTENT, fu_hpi_cfu_handler_check_update_content},
+    {FU_HPI_CFU_STATE_NOTIFY_ON_READY, fu_hpi_cfu_handler_notify_on_ready},
+    {FU_HPI_CFU_STATE_WAIT_FOR_READY_NOTIFICATION, fu_hpi_cfu_handler_wait_for_ready_notification},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_BY_SENDING_OFFER_LIST_AGAIN,
-     fu_hpi_cfu_handler_swap_pending_send_offer_list_again,
-     NULL},
+     fu_hpi_cfu_handler_swap_pending_send_offer_list_again},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_OFFER_LIST_ACCEPTED,
-     fu_hpi_cfu_handler_swap_pending_offer_list_accepted,
-     NULL},
+     fu_hpi_cfu_handler_swap_pending_offer_list_accepted},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_SEND_OFFER_AGAIN,
-     fu_hpi_cfu_handler_swap_pending_send_offer_again,
-     &handler_options},
+     fu_hpi_cfu_handler_swap_pending_send_offer_again},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_OFFER_ACCEPTED,
-     fu_hpi_cfu_handler_swap_pending_send_offer_list_accepted,
-     NULL},
+     fu_hpi_cfu_handler_swap_pending_send_offer_list_accepted},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_SEND_UPDATE_END_OFFER_LIST,
-     fu_hpi_cfu_handler_send_end_offer_list,
-     NULL},
+     fu_hpi_cfu_handler_send_end_offer_list},
     {FU_HPI_CFU_STATE_VERIFY_CHECK_SWAP_PENDING_UPDATE_END_OFFER_LIST_ACCEPTED,
-     fu_hpi_cfu_handler_send_end_offer_list_accepted,
-     NULL},
-    {FU_HPI_CFU_STATE_UPDATE_VERIFY_ERROR, fu_hpi_cfu_handler_verify_error, NULL},
+     fu_hpi_cfu_handler_send_end_offer_list_accepted},
+    {FU_HPI_CFU_STATE_UPDATE_VERIFY_ERROR, fu_hpi_cfu_handler_verify_error},
+    {FU_HPI_CFU_STATE_PIPELINED_HANDSHAKE, fu_hpi_cfu_handler_pipelined_handshake},
 };
 
+/* the offer is needed again to activate, possibly after the daemon has restarted */
+static gchar *
+fu_hpi_cfu_device_get_pending_offer_filename(FuHpiCfuDevice *self)
+{
+	g_autofree gchar *localstatedir = fu_path_from_kind(FU_PATH_KIND_LOCALSTATEDIR_PKG);
+	g_autofree gchar *basename = g_strdup_printf("%s.offer", fu_device_get_id(FU_DEVICE(self)));
+	return g_build_filename(localstatedir, "hpi-cfu", basename, NULL);
+}
+
 static gboolean
-fu_hpi_cfu_device_setup(FuDevice *device, GError **error)
+fu_hpi_cfu_device_save_pending_offer(FuHpiCfuDevice *self, GBytes *offer, GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	guint8 flags = 0;
+	g_autofree gchar *filename = fu_hpi_cfu_device_get_pending_offer_filename(self);
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	g_autoptr(GBytes) blob = NULL;
+
+	/* a forced install has to ignore the version again when activated */
+	fu_byte_array_append_bytes(buf, offer);
+	if (!fu_memread_uint8_safe(buf->data, buf->len, 0x1, &flags, error))
+		return FALSE;
+	flags &= ~FU_HPI_CFU_OFFER_FLAG_MASK_FORCE;
+	flags |= priv->offer_flags & FU_HPI_CFU_OFFER_FLAG_FORCE_IGNORE_VERSION;
+	if (!fu_memwrite_uint8_safe(buf->data, buf->len, 0x1, flags, error))
+		return FALSE;
+	blob = g_bytes_new(buf->data, buf->len);
+	if (!fu_path_mkdir_parent(filename, error))
+		return FALSE;
+	return fu_bytes_set_contents(filename, blob, error);
+}
+
+static void
+fu_hpi_cfu_device_delete_pending_offer(FuHpiCfuDevice *self)
+{
+	g_autofree gchar *filename = fu_hpi_cfu_device_get_pending_offer_filename(self);
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GFile) file = g_file_new_for_path(filename);
+
+	if (!g_file_delete(file, NULL, &error_local) &&
+	    !g_error_matches(error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		g_warning("failed to delete %s: %s", filename, error_local->message);
+}
+
+/* the staged image is only done with once the dock comes back running it */
+static void
+fu_hpi_cfu_device_check_pending_offer(FuHpiCfuDevice *self)
+{
+	g_autofree gchar *filename = fu_hpi_cfu_device_get_pending_offer_filename(self);
+	g_autoptr(FuFirmware) offer = fu_hpi_cfu_offer_new();
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+		return;
+	blob = fu_bytes_get_contents(filename, &error_local);
+	if (blob == NULL) {
+		g_warning("failed to load staged offer: %s", error_local->message);
+		return;
+	}
+	if (!fu_firmware_parse_bytes(offer, blob, 0x0, FU_FIRMWARE_PARSE_FLAG_NONE, &error_local)) {
+		g_warning("ignoring invalid staged offer: %s", error_local->message);
+		fu_hpi_cfu_device_delete_pending_offer(self);
+		return;
+	}
+
+	/* not activated yet, possibly from before the daemon was restarted */
+	if (g_strcmp0(fu_firmware_get_version(offer), fu_device_get_version(FU_DEVICE(self))) != 0) {
+		g_info("staged image %s waiting for activation", fu_firmware_get_version(offer));
+		fu_device_add_flag(FU_DEVICE(self), FWUPD_DEVICE_FLAG_NEEDS_ACTIVATION);
+		return;
+	}
+	g_info("staged image %s activated", fu_firmware_get_version(offer));
+	fu_hpi_cfu_device_delete_pending_offer(self);
+}
+
+/**
+ * fu_hpi_cfu_device_ensure_version:
+ * @self: a #FuHpiCfuDevice
+ * @error: (nullable): optional return location for an error
+ *
+ * Reads the version report from the dock, which also has the ack window and the
+ * component ID.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+fu_hpi_cfu_device_ensure_version(FuHpiCfuDevice *self, GError **error)
 {
 	g_autoptr(GError) error_local = NULL;
-	g_autofree gchar *version = NULL;
 	guint32 version_raw;
 
 	/* Header is 4 bytes. */
@@ -1792,29 +2302,17 @@ fu_hpi_cfu_device_setup(FuDevice *device, GError **error)
 	guint8 buf[60];
 	g_autoptr(GBytes) device_version_response = NULL;
 
-	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
 	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
 
-	g_return_val_if_fail(FU_HPI_CFU_DEVICE(self), FALSE);
+	g_return_val_if_fail(FU_IS_HPI_CFU_DEVICE(self), FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	/* FuHidDevice->setup */
-	if (!FU_DEVICE_CLASS(fu_hpi_cfu_device_parent_class)->setup(device, error))
-		return FALSE;
-
-	if (!fu_usb_device_control_transfer(FU_USB_DEVICE(self),
-					    FU_USB_DIRECTION_DEVICE_TO_HOST,
-					    FU_USB_REQUEST_TYPE_VENDOR,
-					    FU_USB_RECIPIENT_DEVICE,
-					    GET_REPORT,
-					    FEATURE_REPORT_TYPE | FIRMWARE_REPORT_ID,
-					    priv->iface_number,
-					    buf,
-					    sizeof(buf),
-					    &actual_length,
-					    FU_HPI_CFU_DEVICE_TIMEOUT,
-					    NULL,
-					    &error_local)) {
+	if (!fu_hpi_cfu_device_read_version_report(self,
+						   buf,
+						   sizeof(buf),
+						   &actual_length,
+						   FU_HPI_CFU_DEVICE_TIMEOUT,
+						   &error_local)) {
 		g_set_error(error,
 			    FWUPD_ERROR,
 			    FWUPD_ERROR_INVALID_DATA,
@@ -1831,7 +2329,7 @@ fu_hpi_cfu_device_setup(FuDevice *device, GError **error)
 		      "fu_hpi_cfu_device_setup: bytes received",
 		      device_version_response);
 
-	fu_device_set_version(device,
+	fu_device_set_version(FU_DEVICE(self),
 			      g_strdup_printf("%02x.%02x.%02x.%02x",
 					      (version_raw >> 24) & 0xff,
 					      (version_raw >> 16) & 0xff,
@@ -1852,10 +2350,271 @@ fu_hpi_cfu_device_setup(FuDevice *device, GError **error)
 
 	g_debug("fu_hpi_cfu_device_setup: bulk_acksize: %d", priv->bulk_acksize);
 
+	/* used to pick the images from a multi-model archive */
+	if (!fu_memread_uint8_safe(buf,
+				   sizeof(buf),
+				   versionTableOffset + componentIndex * componentDataSize +
+				       componentIDOffset + 1,
+				   &priv->component_id,
+				   error))
+		return FALSE;
+	g_debug("fu_hpi_cfu_device_setup: component_id: 0x%02x", priv->component_id);
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_device_setup(FuDevice *device, GError **error)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
+
+	/* FuHidDevice->setup */
+	if (!FU_DEVICE_CLASS(fu_hpi_cfu_device_parent_class)->setup(device, error))
+		return FALSE;
+
+	if (!fu_hpi_cfu_device_ensure_version(self, error))
+		return FALSE;
+
+	/* activated, or still waiting to be */
+	fu_hpi_cfu_device_check_pending_offer(self);
+
 	/* success */
 	return TRUE;
 }
 
+/* the main context is iterated while writing, so the daemon can call back into the device */
+static gboolean
+fu_hpi_cfu_device_ensure_idle(FuHpiCfuDevice *self, GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	if (priv->writing) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_BUSY,
+				    "dock is already being updated");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* only called on the main thread, the cache is not shared with the packetize thread */
+static void
+fu_hpi_cfu_device_cache_image(FuHpiCfuDevice *self, FuHpiCfuImage *image)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	if (priv->image_cache == NULL || priv->cache_key == NULL)
+		return;
+	if (g_hash_table_size(priv->image_cache) >= FU_HPI_CFU_IMAGE_CACHE_MAX)
+		g_hash_table_remove_all(priv->image_cache);
+	g_hash_table_insert(priv->image_cache, g_strdup(priv->cache_key), g_object_ref(image));
+}
+
+static FuFirmware *
+fu_hpi_cfu_device_prepare_firmware(FuDevice *device,
+				   GInputStream *stream,
+				   FuProgress *progress,
+				   FuFirmwareParseFlags flags,
+				   GError **error)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_autoptr(FuFirmware) firmware = fu_archive_firmware_new();
+	g_autoptr(FuFirmware) fw_manifest = NULL;
+
+	if (!fu_hpi_cfu_device_ensure_idle(self, error))
+		return NULL;
+	if (!fu_firmware_parse_stream(firmware, stream, 0x0, flags, error))
+		return NULL;
+	g_clear_object(&priv->image);
+	g_clear_object(&priv->image_alternate);
+	g_clear_pointer(&priv->cache_key, g_free);
+	g_clear_pointer(&priv->image_prefix, g_free);
+	g_clear_pointer(&priv->image_alternate_prefix, g_free);
+
+	/* an archive for several models says which images are for this one */
+	fw_manifest = fu_archive_firmware_get_image_fnmatch(FU_ARCHIVE_FIRMWARE(firmware),
+							    "manifest.ini",
+							    NULL);
+	if (fw_manifest != NULL) {
+		const gchar *prefix;
+		const gchar *alternate_prefix = NULL;
+		g_autoptr(FuHpiCfuManifest) manifest = NULL;
+		g_autoptr(GBytes) blob_manifest = fu_firmware_get_bytes(fw_manifest, error);
+
+		if (blob_manifest == NULL)
+			return NULL;
+		manifest = fu_hpi_cfu_manifest_new_from_bytes(blob_manifest, error);
+		if (manifest == NULL) {
+			g_prefix_error(error, "failed to parse manifest: ");
+			return NULL;
+		}
+		prefix = fu_hpi_cfu_manifest_lookup(manifest,
+						    fu_device_get_pid(device),
+						    fu_usb_device_get_release(FU_USB_DEVICE(self)),
+						    priv->component_id,
+						    &alternate_prefix);
+		if (prefix == NULL) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_NOT_SUPPORTED,
+				    "archive has no images for 0x%04x revision 0x%04x component 0x%02x",
+				    fu_device_get_pid(device),
+				    fu_usb_device_get_release(FU_USB_DEVICE(self)),
+				    priv->component_id);
+			return NULL;
+		}
+		g_debug("using images %s", prefix);
+		priv->image_prefix = g_strdup(prefix);
+		priv->image_alternate_prefix = g_strdup(alternate_prefix);
+	}
+
+	/* already decoded and packetized for another dock */
+	if (priv->image_cache != NULL) {
+		FuHpiCfuImage *image;
+		g_autofree gchar *checksum =
+		    fu_firmware_get_checksum(firmware, G_CHECKSUM_SHA256, error);
+		if (checksum == NULL)
+			return NULL;
+		if (priv->image_prefix != NULL)
+			priv->cache_key = g_strdup_printf("%s:%s", checksum, priv->image_prefix);
+		else
+			priv->cache_key = g_steal_pointer(&checksum);
+		image = g_hash_table_lookup(priv->image_cache, priv->cache_key);
+		if (image != NULL) {
+			g_debug("using cached image for %s", priv->cache_key);
+			priv->image = g_object_ref(image);
+		}
+	}
+
+	/* parse and validate everything now, only the packetizing overlaps the handshake */
+	if (priv->image == NULL) {
+		priv->image =
+		    fu_hpi_cfu_image_new_from_archive(firmware, priv->image_prefix, error);
+		if (priv->image == NULL)
+			return NULL;
+	}
+
+	/* the other bank too, so a broken image fails here rather than in the offer list */
+	if (priv->image_alternate_prefix != NULL) {
+		priv->image_alternate =
+		    fu_hpi_cfu_image_new_from_archive(firmware, priv->image_alternate_prefix, error);
+		if (priv->image_alternate == NULL) {
+			g_prefix_error(error, "failed to load %s: ", priv->image_alternate_prefix);
+			return NULL;
+		}
+	}
+
+	/* success */
+	return g_steal_pointer(&firmware);
+}
+
+/**
+ * fu_hpi_cfu_device_set_image_cache:
+ * @self: a #FuHpiCfuDevice
+ * @image_cache: (nullable): a #GHashTable of checksum:#FuHpiCfuImage
+ *
+ * Sets the cache of decoded archives shared with the other devices of the plugin.
+ **/
+void
+fu_hpi_cfu_device_set_image_cache(FuHpiCfuDevice *self, GHashTable *image_cache)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+
+	if (priv->image_cache != NULL)
+		g_hash_table_unref(priv->image_cache);
+	priv->image_cache = image_cache != NULL ? g_hash_table_ref(image_cache) : NULL;
+}
+
+/**
+ * fu_hpi_cfu_device_set_max_transfer_rate:
+ * @self: a #FuHpiCfuDevice
+ * @max_transfer_rate: payload bytes per second, or 0 for no limit
+ *
+ * Sets the average rate the content reports are sent at, so that an update can run in
+ * the background without taking the bandwidth of the other devices on the dock.
+ **/
+void
+fu_hpi_cfu_device_set_max_transfer_rate(FuHpiCfuDevice *self, guint64 max_transfer_rate)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+	priv->max_transfer_rate = max_transfer_rate;
+}
+
+/**
+ * fu_hpi_cfu_device_set_worker_scheduling:
+ * @self: a #FuHpiCfuDevice
+ * @policy: the scheduling policy, e.g. `SCHED_FIFO`
+ * @nice: the nice value, used for `SCHED_OTHER` and `SCHED_BATCH`
+ * @cpus: a bitmask of the CPUs to run on, or 0 for any
+ *
+ * Sets how the thread sending the content reports is scheduled, so that a busy host
+ * does not delay the reply to each ack.
+ **/
+void
+fu_hpi_cfu_device_set_worker_scheduling(FuHpiCfuDevice *self, gint policy, gint nice, guint64 cpus)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+	priv->worker_policy = policy;
+	priv->worker_nice = nice;
+	priv->worker_cpus = cpus;
+}
+
+/**
+ * fu_hpi_cfu_device_set_capture_directory:
+ * @self: a #FuHpiCfuDevice
+ * @capture_directory: (nullable): a directory, or %NULL to not capture
+ *
+ * Sets where every transfer of each update is written to as a pcapng file.
+ **/
+void
+fu_hpi_cfu_device_set_capture_directory(FuHpiCfuDevice *self, const gchar *capture_directory)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+	g_free(priv->capture_directory);
+	priv->capture_directory = g_strdup(capture_directory);
+}
+
+/**
+ * fu_hpi_cfu_device_set_skip_replug:
+ * @self: a #FuHpiCfuDevice
+ * @skip_replug: %TRUE if an upstream dock is updated after this one
+ *
+ * Sets if the install should return without waiting for the dock to come back
+ * after the reboot, as the upstream dock reboot takes this one down too.
+ **/
+void
+fu_hpi_cfu_device_set_skip_replug(FuHpiCfuDevice *self, gboolean skip_replug)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+	priv->skip_replug = skip_replug;
+}
+
+/**
+ * fu_hpi_cfu_device_get_rebooting:
+ * @self: a #FuHpiCfuDevice
+ *
+ * Gets if the last install was written and the dock is rebooting into it, rather than the
+ * install failing, being staged or not being needed.
+ *
+ * Returns: %TRUE if the dock reboots, waited for or not
+ **/
+gboolean
+fu_hpi_cfu_device_get_rebooting(FuHpiCfuDevice *self)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(FU_IS_HPI_CFU_DEVICE(self), FALSE);
+	return priv->rebooting;
+}
+
 static void
 fu_hpi_cfu_set_progress(FuDevice *self, FuProgress *progress)
 {
@@ -1868,6 +2627,417 @@ fu_hpi_cfu_set_progress(FuDevice *self, FuProgress *progress)
 	fu_progress_add_step(progress, FWUPD_STATUS_DEVICE_BUSY, 5, "reload");
 }
 
+static gboolean
+fu_hpi_cfu_device_run_state_machine(FuHpiCfuDevice *self, FuProgress *progress, GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	if (!fu_hpi_cfu_device_resync(self, error))
+		return FALSE;
+
+	/* cfu state machine framework */
+	while (!priv->exit_state_machine_framework) {
+		FuHpiCfuState state = priv->state;
+		if (g_cancellable_set_error_if_cancelled(priv->cancellable, error)) {
+			fu_hpi_cfu_device_abort_or_warn(self);
+			return FALSE;
+		}
+		if (!hpi_cfu_states[state].handler(self,
+						   priv,
+						   progress,
+						   &priv->handler_options,
+						   error)) {
+			fu_hpi_cfu_device_save_flight_record(self);
+			fu_hpi_cfu_device_abort_or_warn(self);
+			g_prefix_error(error, "failed at state: ");
+			return FALSE;
+		}
+		if (priv->state != state) {
+			FU_HPI_CFU_PROBE2(state_change, state, priv->state);
+			fu_hpi_cfu_recorder_add(priv->recorder,
+						FU_HPI_CFU_RECORDER_KIND_STATE,
+						priv->state,
+						-1,
+						-1,
+						0,
+						0);
+		}
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_device_worker_done_cb(gpointer user_data)
+{
+	FuHpiCfuDeviceWorkerHelper *helper = (FuHpiCfuDeviceWorkerHelper *)user_data;
+	helper->done = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+/* only ever called on the write thread, so the rest of the daemon is unaffected */
+static void
+fu_hpi_cfu_device_worker_set_scheduling(FuHpiCfuDevicePrivate *priv)
+{
+	struct sched_param param = {0};
+	gint rc;
+
+	if (priv->worker_policy == SCHED_FIFO || priv->worker_policy == SCHED_RR)
+		param.sched_priority = sched_get_priority_min(priv->worker_policy);
+	if (priv->worker_policy != SCHED_OTHER) {
+		rc = pthread_setschedparam(pthread_self(), priv->worker_policy, &param);
+		if (rc != 0)
+			g_warning("failed to set scheduling policy: %s", g_strerror(rc));
+	}
+#ifdef __linux__
+	/* the nice value is per-thread on Linux */
+	if (priv->worker_nice != 0) {
+		if (setpriority(PRIO_PROCESS, gettid(), priv->worker_nice) != 0)
+			g_warning("failed to set nice value: %s", g_strerror(errno));
+	}
+	if (priv->worker_cpus != 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		for (guint i = 0; i < 64; i++) {
+			if (priv->worker_cpus & (1ull << i))
+				CPU_SET(i, &cpuset);
+		}
+		rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (rc != 0)
+			g_warning("failed to set CPU affinity: %s", g_strerror(rc));
+	}
+#endif
+}
+
+static gpointer
+fu_hpi_cfu_device_worker_cb(gpointer user_data)
+{
+	FuHpiCfuDeviceWorkerHelper *helper = (FuHpiCfuDeviceWorkerHelper *)user_data;
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(helper->self);
+
+	fu_hpi_cfu_device_worker_set_scheduling(priv);
+	helper->ret = fu_hpi_cfu_device_run_state_machine(helper->self,
+							  helper->progress,
+							  &helper->error);
+
+	/* queued after any progress updates */
+	g_main_context_invoke(priv->context, fu_hpi_cfu_device_worker_done_cb, helper);
+	return NULL;
+}
+
+static gboolean
+fu_hpi_cfu_device_run_worker(FuHpiCfuDevice *self, FuProgress *progress, GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	FuHpiCfuDeviceWorkerHelper helper = {
+	    .self = self,
+	    .progress = progress,
+	};
+	GThread *thread;
+	g_autoptr(FuHpiCfuDevice) self_ref = g_object_ref(self);
+	g_autoptr(GMainContext) context = g_main_context_ref_thread_default();
+
+	g_cancellable_reset(priv->cancellable);
+
+	/* not the thread running the main loop, so nothing to keep responsive */
+	if (!g_main_context_acquire(context))
+		return fu_hpi_cfu_device_run_state_machine(self, progress, error);
+
+	priv->context = context;
+	thread = g_thread_try_new("hpi-cfu-write", fu_hpi_cfu_device_worker_cb, &helper, error);
+	if (thread == NULL) {
+		priv->context = NULL;
+		g_main_context_release(context);
+		return FALSE;
+	}
+
+	/* the daemon keeps running, so another install or activate of this dock is refused, and
+	 * removing the dock cancels the transfer but cannot free the device under the thread */
+	priv->writing = TRUE;
+	while (!helper.done)
+		g_main_context_iteration(context, TRUE);
+	g_thread_join(thread);
+	priv->writing = FALSE;
+	priv->context = NULL;
+	g_main_context_release(context);
+
+	if (!helper.ret) {
+		g_propagate_error(error, helper.error);
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_device_cancel:
+ * @self: a #FuHpiCfuDevice
+ *
+ * Cancels any transfer in progress, e.g. because the dock has been removed.
+ **/
+void
+fu_hpi_cfu_device_cancel(FuHpiCfuDevice *self)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(FU_IS_HPI_CFU_DEVICE(self));
+	g_cancellable_cancel(priv->cancellable);
+}
+
+static void
+fu_hpi_cfu_device_telemetry_done(FuHpiCfuDevicePrivate *priv)
+{
+	priv->telemetry.packets_sent = priv->sequence_number;
+	priv->telemetry.retries = priv->retry_attempts;
+	priv->telemetry.done_time = g_get_monotonic_time();
+}
+
+/* average round trip of the version report, which is about the cost of one report or ack */
+static gboolean
+fu_hpi_cfu_device_measure_latency(FuHpiCfuDevice *self, gint64 *latency, GError **error)
+{
+	gint64 total = 0;
+
+	for (guint i = 0; i < FU_HPI_CFU_DEVICE_LATENCY_SAMPLES; i++) {
+		gsize actual_length = 0;
+		guint8 buf[60] = {0};
+		gint64 start_time = g_get_monotonic_time();
+		if (!fu_hpi_cfu_device_read_version_report(self,
+							   buf,
+							   sizeof(buf),
+							   &actual_length,
+							   FU_HPI_CFU_DEVICE_TIMEOUT,
+							   error))
+			return FALSE;
+		total += g_get_monotonic_time() - start_time;
+	}
+	*latency = total / FU_HPI_CFU_DEVICE_LATENCY_SAMPLES;
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_device_dry_run:
+ * @self: a #FuHpiCfuDevice
+ * @stream: a #GInputStream of the archive
+ * @progress: a #FuProgress
+ * @error: (nullable): optional return location for an error
+ *
+ * Does everything up to the offer for one archive: it is decoded into the exact reports that
+ * would be sent, and the dock is queried for its round trip time, but nothing is written.
+ *
+ * Returns: (transfer container): the estimate as report metadata, or %NULL on error
+ **/
+GHashTable *
+fu_hpi_cfu_device_dry_run(FuHpiCfuDevice *self,
+			  GInputStream *stream,
+			  FuProgress *progress,
+			  GError **error)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	guint reports;
+	guint ack_window;
+	guint acks;
+	gint64 latency = 0;
+	gint64 transfer_time;
+	gint64 reboot_time;
+	g_autoptr(FuFirmware) firmware = NULL;
+	g_autoptr(FuHpiCfuImage) image = NULL;
+	g_autoptr(GHashTable) metadata = NULL;
+
+	g_return_val_if_fail(FU_IS_HPI_CFU_DEVICE(self), NULL);
+	g_return_val_if_fail(G_IS_INPUT_STREAM(stream), NULL);
+	g_return_val_if_fail(FU_IS_PROGRESS(progress), NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	/* the same validation as a real install, and the reports are kept for it */
+	firmware = fu_device_prepare_firmware(FU_DEVICE(self),
+					      stream,
+					      progress,
+					      FU_FIRMWARE_PARSE_FLAG_NONE,
+					      error);
+	if (firmware == NULL)
+		return NULL;
+	image = g_steal_pointer(&priv->image);
+	g_clear_object(&priv->image_alternate);
+	if (!fu_hpi_cfu_image_packetize(image, error))
+		return NULL;
+	fu_hpi_cfu_device_cache_image(self, image);
+
+	reports = fu_hpi_cfu_image_get_reports(image)->len;
+	ack_window = fu_hpi_cfu_device_get_ack_window(priv);
+	acks = (reports + ack_window - 1) / ack_window;
+	if (!fu_hpi_cfu_device_measure_latency(self, &latency, error))
+		return NULL;
+	transfer_time = (gint64)(reports + acks) * latency;
+	if (priv->max_transfer_rate > 0) {
+		gint64 transfer_time_min = (gint64)(fu_hpi_cfu_image_get_payload_size(image) *
+						    G_USEC_PER_SEC / priv->max_transfer_rate);
+		transfer_time = MAX(transfer_time, transfer_time_min);
+	}
+
+	/* measured on the last update if there was one, else the worst case */
+	reboot_time = priv->telemetry.replug_time;
+	if (reboot_time == 0)
+		reboot_time = (gint64)fu_device_get_remove_delay(FU_DEVICE(self)) * 1000;
+
+	metadata = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuDryRunReports"),
+			    g_strdup_printf("%u", reports));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuDryRunAckWindow"),
+			    g_strdup_printf("%u", ack_window));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuDryRunRoundTripUs"),
+			    g_strdup_printf("%" G_GINT64_FORMAT, latency));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuDryRunTransferMs"),
+			    g_strdup_printf("%" G_GINT64_FORMAT, transfer_time / 1000));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuDryRunRebootMs"),
+			    g_strdup_printf("%" G_GINT64_FORMAT, reboot_time / 1000));
+	return g_steal_pointer(&metadata);
+}
+
+/* opt-in, as every report of the update is written to disk */
+static void
+fu_hpi_cfu_device_capture_start(FuHpiCfuDevice *self)
+{
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	guint8 busnum = fu_usb_device_get_bus(FU_USB_DEVICE(self));
+	guint8 devnum = fu_usb_device_get_address(FU_USB_DEVICE(self));
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *timestamp = NULL;
+	g_autoptr(GDateTime) dt = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	if (priv->capture_directory == NULL)
+		return;
+	dt = g_date_time_new_now_utc();
+	timestamp = g_date_time_format(dt, "%Y%m%d-%H%M%S");
+	basename = g_strdup_printf("hpi-cfu-%03u-%03u-%s.pcapng", busnum, devnum, timestamp);
+	filename = g_build_filename(priv->capture_directory, basename, NULL);
+	priv->capture = fu_hpi_cfu_capture_new(filename, busnum, devnum, &error_local);
+	if (priv->capture == NULL) {
+		g_warning("not capturing: %s", error_local->message);
+		return;
+	}
+	g_info("capturing update to %s", filename);
+}
+
+static gboolean
+fu_hpi_cfu_device_activate(FuDevice *device, FuProgress *progress, GError **error)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	guint8 flags = 0;
+	gint32 status = 0;
+	gint32 reply = 0;
+	g_autofree gchar *filename = fu_hpi_cfu_device_get_pending_offer_filename(self);
+	g_autoptr(GBytes) offer = NULL;
+
+	if (!fu_hpi_cfu_device_ensure_idle(self, error))
+		return FALSE;
+	offer = fu_bytes_get_contents(filename, error);
+	if (offer == NULL) {
+		g_prefix_error(error, "no staged image: ");
+		return FALSE;
+	}
+
+	/* a forced install saved the offer with the ignore-version bit set */
+	if (!fu_memread_uint8_safe(g_bytes_get_data(offer, NULL),
+				   g_bytes_get_size(offer),
+				   0x1,
+				   &flags,
+				   error))
+		return FALSE;
+
+	/* offer the staged image again, which the dock answers with swap-pending */
+	g_cancellable_reset(priv->cancellable);
+	priv->offer_flags = flags & FU_HPI_CFU_OFFER_FLAG_FORCE_IGNORE_VERSION;
+	priv->telemetry.reject_reason = -1;
+	fu_progress_set_status(progress, FWUPD_STATUS_DEVICE_RESTART);
+	if (!fu_hpi_cfu_device_resync(self, error))
+		return FALSE;
+	if (!fu_hpi_cfu_start_entire_transaction(self, error))
+		return FALSE;
+	if (!fu_hpi_cfu_start_entire_transaction_accepted(self, priv, error))
+		return FALSE;
+	if (priv->state != FU_HPI_CFU_STATE_START_OFFER_LIST) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_NOT_SUPPORTED,
+				    "dock did not accept the start of the transaction");
+		return FALSE;
+	}
+	if (!fu_hpi_cfu_send_start_offer_list(self, error))
+		return FALSE;
+	if (!fu_hpi_cfu_send_offer_list_accepted(self, &status, error))
+		return FALSE;
+	if (status != FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT) {
+		fu_hpi_cfu_device_abort_or_warn(self);
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_NOT_SUPPORTED,
+			    "dock did not accept the offer list: %s",
+			    fu_hpi_cfu_firmware_update_offer_to_string(status));
+		return FALSE;
+	}
+	if (!fu_hpi_cfu_send_offer_update_command(self, priv, offer, error))
+		return FALSE;
+	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error))
+		return FALSE;
+	if (reply == FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_BUSY) {
+		fu_hpi_cfu_device_abort_or_warn(self);
+		g_set_error_literal(error, FWUPD_ERROR, FWUPD_ERROR_BUSY, "dock is busy");
+		return FALSE;
+	}
+	if (reply != FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT ||
+	    priv->telemetry.reject_reason != FU_HPI_CFU_FIRMWARE_OFFER_REJECT_SWAP_PENDING) {
+		const gchar *str = priv->telemetry.reject_reason >= 0
+				       ? fu_cfu_rr_code_to_string(priv->telemetry.reject_reason)
+				       : NULL;
+		fu_hpi_cfu_device_abort_or_warn(self);
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_NOT_SUPPORTED,
+			    "dock has no staged image: %s",
+			    str != NULL ? str
+					: fu_hpi_cfu_firmware_update_offer_to_string(reply));
+		return FALSE;
+	}
+
+	/* ask the dock to reset into the staged image */
+	if (!fu_hpi_cfu_send_offer_command(self, FU_HPI_CFU_OFFER_COMMAND_ACTIVATE_STAGED, error))
+		return FALSE;
+	if (!fu_hpi_cfu_firmware_update_offer_accepted(self, priv, &reply, error))
+		return FALSE;
+	if (reply != FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT &&
+	    reply != FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_COMMAND_READY) {
+		fu_hpi_cfu_device_abort_or_warn(self);
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_NOT_SUPPORTED,
+			    "dock did not accept the activate command: %s",
+			    fu_hpi_cfu_firmware_update_offer_to_string(reply));
+		return FALSE;
+	}
+	if (!fu_hpi_cfu_send_end_offer_list(self, error))
+		return FALSE;
+	if (!fu_hpi_cfu_end_offer_list_accepted(self, error))
+		return FALSE;
+
+	/* the staged offer is deleted in ->setup once the dock is back on the new version */
+	fu_device_add_flag(device, FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG);
+
+	/* success */
+	return TRUE;
+}
+
 static gboolean
 fu_hpi_cfu_device_write_firmware(FuDevice *device,
 				 FuFirmware *firmware,
@@ -1877,12 +3047,12 @@ fu_hpi_cfu_device_write_firmware(FuDevice *device,
 {
 	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
 	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
-
-	g_autoptr(FuFirmware) fw_offer = NULL;
-	g_autoptr(FuFirmware) fw_payload = NULL;
-	g_autoptr(GBytes) blob_offer = NULL;
-	g_autoptr(GBytes) blob_payload = NULL;
-	gsize payload_file_size = 0;
+	gboolean deferred = fu_device_has_private_flag(device, FU_HPI_CFU_DEVICE_FLAG_DEFERRED);
+	gboolean ret;
+	g_autoptr(GBytes) offer = NULL;
+	g_autoptr(FuHpiCfuImage) image = g_steal_pointer(&priv->image);
+	g_autoptr(FuHpiCfuPower) power = NULL;
+	g_autoptr(FuDeviceLocker) locker = NULL;
 
 	/* progress */
 	fu_progress_set_id(progress, G_STRLOC);
@@ -1892,42 +3062,103 @@ fu_hpi_cfu_device_write_firmware(FuDevice *device,
 	fu_progress_add_step(progress, FWUPD_STATUS_DEVICE_WRITE, 92, "send-payload");
 	fu_progress_add_step(progress, FWUPD_STATUS_DEVICE_RESTART, 8, "restart");
 
-	/* get both images */
-	fw_offer = fu_archive_firmware_get_image_fnmatch(FU_ARCHIVE_FIRMWARE(firmware),
-							 "*.offer.bin",
-							 error);
-	if (fw_offer == NULL)
+	if (!fu_hpi_cfu_device_ensure_idle(self, error))
 		return FALSE;
 
-	fw_payload = fu_archive_firmware_get_image_fnmatch(FU_ARCHIVE_FIRMWARE(firmware),
-							   "*.payload.bin",
-							   error);
-	if (fw_payload == NULL)
+	/* decoded and validated by ->prepare_firmware */
+	if (image == NULL) {
+		g_set_error_literal(error, FWUPD_ERROR, FWUPD_ERROR_INTERNAL, "no image to write");
 		return FALSE;
+	}
 
-	priv->state = FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION;
-	blob_payload = fu_firmware_get_bytes(fw_payload, NULL);
-	g_bytes_get_data(blob_payload, &payload_file_size);
-	priv->curfilepos = 0;
-	priv->payload_file_size = payload_file_size;
-	handler_options.fw_offer = fw_offer;
-	handler_options.fw_payload = fw_payload;
+	priv->offer_flags = fu_hpi_cfu_offer_flags_for_install(
+	    flags,
+	    fu_device_has_private_flag(device, FU_HPI_CFU_DEVICE_FLAG_FORCE_VERSION),
+	    fu_device_has_private_flag(device, FU_HPI_CFU_DEVICE_FLAG_FORCE_RESET),
+	    deferred);
+	priv->swap_pending = FALSE;
+	priv->bank_rejected = FALSE;
+	priv->rebooting = FALSE;
+
+	if (fu_device_has_private_flag(device, FU_HPI_CFU_DEVICE_FLAG_PIPELINED))
+		priv->state = FU_HPI_CFU_STATE_PIPELINED_HANDSHAKE;
+	else
+		priv->state = FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION;
+	priv->retry_attempts = 0;
+	priv->firmware_status = FALSE;
+	priv->exit_state_machine_framework = FALSE;
+
+	fu_hpi_cfu_recorder_reset(priv->recorder);
+	memset(&priv->telemetry, 0x0, sizeof(priv->telemetry));
+	priv->telemetry.image_size = fu_hpi_cfu_image_get_payload_size(image);
+	priv->telemetry.reject_reason = -1;
+	priv->telemetry.content_status = -1;
+	priv->telemetry.start_time = g_get_monotonic_time();
+
+	/* no runtime PM on the dock or its hubs while transferring */
+	power = fu_hpi_cfu_power_new(FU_UDEV_DEVICE(self));
+	locker = fu_device_locker_new_full(G_OBJECT(power),
+					   (FuDeviceLockerFunc)fu_hpi_cfu_power_pin,
+					   (FuDeviceLockerFunc)fu_hpi_cfu_power_restore,
+					   error);
+	if (locker == NULL)
+		return FALSE;
 
-	/* cfu state machine framework */
-	while (!priv->exit_state_machine_framework) {
-		if (!hpi_cfu_states[priv->state].handler(self,
-							 priv,
-							 progress,
-							 hpi_cfu_states[priv->state].options,
-							 error)) {
-			g_prefix_error(error, "failed at state: ");
+	/* not in the cache, so build the reports on another thread while the handshake waits
+	 * on the dock; they are only needed once the offer has been accepted */
+	if (!fu_hpi_cfu_image_is_packetized(image) &&
+	    !fu_hpi_cfu_device_packetize_start(self, image, error))
+		return FALSE;
+
+	/* thousands of blocking transfers, so keep the daemon responsive meanwhile */
+	priv->handler_options.image = image;
+	priv->handler_options.image_alternate = g_steal_pointer(&priv->image_alternate);
+	fu_hpi_cfu_device_capture_start(self);
+	ret = fu_hpi_cfu_device_run_worker(self, progress, error);
+	fu_hpi_cfu_device_telemetry_done(priv);
+	g_clear_object(&priv->capture);
+
+	/* the handshake may have failed before the reports were needed */
+	fu_hpi_cfu_device_packetize_join(priv);
+	if (priv->packetize.error == NULL && fu_hpi_cfu_image_is_packetized(image))
+		fu_hpi_cfu_device_cache_image(self, image);
+	g_clear_error(&priv->packetize.error);
+	if (priv->handler_options.image != NULL)
+		offer = g_bytes_ref(fu_hpi_cfu_image_get_offer(priv->handler_options.image));
+	priv->handler_options.image = NULL;
+	g_clear_object(&priv->handler_options.image_alternate);
+	if (!ret)
+		return FALSE;
+	g_clear_object(&locker);
+
+	if (priv->firmware_status && deferred) {
+		/* staged, the reboot happens in ->activate */
+		if (!priv->swap_pending) {
+			g_set_error_literal(error,
+					    FWUPD_ERROR,
+					    FWUPD_ERROR_WRITE,
+					    "image written but dock did not report a pending swap");
 			return FALSE;
 		}
-	}
-
-	if (priv->firmware_status) {
-		/* the device automatically reboots */
-		fu_device_add_flag(device, FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG);
+		if (!fu_hpi_cfu_device_save_pending_offer(self, offer, error))
+			return FALSE;
+		fu_device_add_flag(device, FWUPD_DEVICE_FLAG_NEEDS_ACTIVATION);
+		fu_progress_finished(progress);
+	} else if (priv->firmware_status) {
+		/* anything staged earlier has been replaced */
+		fu_hpi_cfu_device_delete_pending_offer(self);
+
+		/* the device automatically reboots, but an upstream dock updated later
+		 * in the same batch takes the hub down again anyway */
+		priv->rebooting = TRUE;
+		if (priv->skip_replug) {
+			g_info("not waiting for replug, upstream dock is updated next");
+		} else {
+			fu_device_add_flag(device, FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG);
+		}
+	} else {
+		/* no reboot to wait for */
+		fu_progress_finished(progress);
 	}
 
 	return TRUE;
@@ -1939,7 +3170,10 @@ fu_hpi_cfu_device_init(FuHpiCfuDevice *self)
 	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
 
 	priv->iface_number = 0x00;
+	priv->worker_policy = SCHED_OTHER;
 	priv->state = FU_HPI_CFU_STATE_START_ENTIRE_TRANSACTION;
+	priv->cancellable = g_cancellable_new();
+	priv->recorder = fu_hpi_cfu_recorder_new(FU_HPI_CFU_DEVICE_RECORDER_SIZE);
 
 	fu_device_add_protocol(FU_DEVICE(self), "com.microsoft.cfu");
 	fu_device_set_version_format(FU_DEVICE(self), FWUPD_VERSION_FORMAT_QUAD);
@@ -1948,17 +3182,140 @@ fu_hpi_cfu_device_init(FuHpiCfuDevice *self)
 	fu_device_add_flag(FU_DEVICE(self), FWUPD_DEVICE_FLAG_UNSIGNED_PAYLOAD);
 	fu_device_set_firmware_gtype(FU_DEVICE(self), FU_TYPE_ARCHIVE_FIRMWARE);
 	fu_device_add_private_flag(FU_DEVICE(self), FU_DEVICE_PRIVATE_FLAG_ADD_INSTANCE_ID_REV);
+	fu_device_register_private_flag(FU_DEVICE(self), FU_HPI_CFU_DEVICE_FLAG_FORCE_VERSION);
+	fu_device_register_private_flag(FU_DEVICE(self), FU_HPI_CFU_DEVICE_FLAG_FORCE_RESET);
+	fu_device_register_private_flag(FU_DEVICE(self), FU_HPI_CFU_DEVICE_FLAG_PIPELINED);
+	fu_device_register_private_flag(FU_DEVICE(self), FU_HPI_CFU_DEVICE_FLAG_DEFERRED);
 
 	/* The HP Dock device reboot takes down the entire hub for ~12 minutes */
 	fu_device_set_remove_delay(FU_DEVICE(self), 720 * 1000);
 }
 
+static void
+fu_hpi_cfu_device_replace(FuDevice *device, FuDevice *donor)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	FuHpiCfuDevicePrivate *priv_donor;
+
+	if (!FU_IS_HPI_CFU_DEVICE(donor))
+		return;
+
+	/* the same dock back after the reboot into the new firmware */
+	priv_donor = GET_PRIVATE(FU_HPI_CFU_DEVICE(donor));
+	priv->telemetry = priv_donor->telemetry;
+	if (priv->telemetry.done_time != 0)
+		priv->telemetry.replug_time = g_get_monotonic_time() - priv->telemetry.done_time;
+}
+
+static void
+fu_hpi_cfu_device_report_metadata_post(FuDevice *device, GHashTable *metadata)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(device);
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+	FuHpiCfuDeviceTelemetry *telemetry = &priv->telemetry;
+
+	/* not updated */
+	if (telemetry->start_time == 0)
+		return;
+
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuImageSize"),
+			    g_strdup_printf("%" G_GSIZE_FORMAT, telemetry->image_size));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuPacketsSent"),
+			    g_strdup_printf("%u", telemetry->packets_sent));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuAckWindow"),
+			    g_strdup_printf("%u", fu_hpi_cfu_device_get_ack_window(priv)));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuHandshakeMs"),
+			    g_strdup_printf("%" G_GINT64_FORMAT, telemetry->handshake_time / 1000));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuTransferMs"),
+			    g_strdup_printf("%" G_GINT64_FORMAT, telemetry->transfer_time / 1000));
+	if (telemetry->replug_time != 0) {
+		g_hash_table_insert(
+		    metadata,
+		    g_strdup("HpiCfuReplugMs"),
+		    g_strdup_printf("%" G_GINT64_FORMAT, telemetry->replug_time / 1000));
+	}
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuRetries"),
+			    g_strdup_printf("%u", telemetry->retries));
+	g_hash_table_insert(metadata,
+			    g_strdup("HpiCfuBusyEvents"),
+			    g_strdup_printf("%u", telemetry->busy_events));
+	if (telemetry->rtt_count > 0) {
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuAckRttMinUs"),
+				    g_strdup_printf("%" G_GINT64_FORMAT, telemetry->rtt_min));
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuAckRttMeanUs"),
+				    g_strdup_printf("%.0f", telemetry->rtt_mean));
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuAckRttMaxUs"),
+				    g_strdup_printf("%" G_GINT64_FORMAT, telemetry->rtt_max));
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuAckRttJitterUs"),
+				    g_strdup_printf("%.0f", telemetry->rtt_jitter));
+	}
+	if (telemetry->reject_reason >= 0) {
+		const gchar *str = fu_cfu_rr_code_to_string(telemetry->reject_reason);
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuRejectReason"),
+				    str != NULL ? g_strdup(str)
+						: g_strdup_printf("0x%02x", (guint)telemetry->reject_reason));
+	}
+	if (telemetry->content_status >= 0) {
+		const gchar *str = fu_cfu_content_status_to_string(telemetry->content_status);
+		g_hash_table_insert(metadata,
+				    g_strdup("HpiCfuContentStatus"),
+				    str != NULL ? g_strdup(str)
+						: g_strdup_printf("0x%02x", (guint)telemetry->content_status));
+	}
+}
+
+static void
+fu_hpi_cfu_device_finalize(GObject *object)
+{
+	FuHpiCfuDevice *self = FU_HPI_CFU_DEVICE(object);
+	FuHpiCfuDevicePrivate *priv = GET_PRIVATE(self);
+
+	if (priv->image != NULL)
+		g_object_unref(priv->image);
+	if (priv->image_alternate != NULL)
+		g_object_unref(priv->image_alternate);
+	g_free(priv->cache_key);
+	g_free(priv->image_prefix);
+	g_free(priv->capture_directory);
+	g_free(priv->image_alternate_prefix);
+	g_object_unref(priv->cancellable);
+	if (priv->image_cache != NULL)
+		g_hash_table_unref(priv->image_cache);
+	if (priv->capture != NULL)
+		g_object_unref(priv->capture);
+	g_object_unref(priv->recorder);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_device_parent_class)->finalize(object);
+}
+
 static void
 fu_hpi_cfu_device_class_init(FuHpiCfuDeviceClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 	FuDeviceClass *device_class = FU_DEVICE_CLASS(klass);
 
+	object_class->finalize = fu_hpi_cfu_device_finalize;
+
+	device_class->prepare_firmware = fu_hpi_cfu_device_prepare_firmware;
 	device_class->write_firmware = fu_hpi_cfu_device_write_firmware;
+	device_class->activate = fu_hpi_cfu_device_activate;
 	device_class->setup = fu_hpi_cfu_device_setup;
 	device_class->set_progress = fu_hpi_cfu_set_progress;
+	device_class->replace = fu_hpi_cfu_device_replace;
+	device_class->report_metadata_post = fu_hpi_cfu_device_report_metadata_post;
+
+	klass->control_transfer = fu_hpi_cfu_device_real_control_transfer;
+	klass->interrupt_transfer = fu_hpi_cfu_device_real_interrupt_transfer;
 }
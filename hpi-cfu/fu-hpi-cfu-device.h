@@ -10,3 +10,49 @@
 
 #define FU_TYPE_HPI_CFU_DEVICE (fu_hpi_cfu_device_get_type())
 G_DECLARE_DERIVABLE_TYPE(FuHpiCfuDevice, fu_hpi_cfu_device, FU, HPI_CFU_DEVICE, FuUsbDevice)
+
+struct _FuHpiCfuDeviceClass {
+	FuUsbDeviceClass parent_class;
+	/* the USB transfers to the dock, overridden by the benchmark to use a stand-in dock */
+	gboolean (*control_transfer)(FuHpiCfuDevice *self,
+				     FuUsbDirection direction,
+				     guint8 request,
+				     guint16 value,
+				     guint16 idx,
+				     guint8 *data,
+				     gsize length,
+				     gsize *actual_length,
+				     guint timeout,
+				     GCancellable *cancellable,
+				     GError **error);
+	gboolean (*interrupt_transfer)(FuHpiCfuDevice *self,
+				       guint8 endpoint,
+				       guint8 *data,
+				       gsize length,
+				       gsize *actual_length,
+				       guint timeout,
+				       GCancellable *cancellable,
+				       GError **error);
+};
+
+gboolean
+fu_hpi_cfu_device_ensure_version(FuHpiCfuDevice *self, GError **error);
+GHashTable *
+fu_hpi_cfu_device_dry_run(FuHpiCfuDevice *self,
+			  GInputStream *stream,
+			  FuProgress *progress,
+			  GError **error);
+void
+fu_hpi_cfu_device_set_image_cache(FuHpiCfuDevice *self, GHashTable *image_cache);
+void
+fu_hpi_cfu_device_set_max_transfer_rate(FuHpiCfuDevice *self, guint64 max_transfer_rate);
+void
+fu_hpi_cfu_device_set_worker_scheduling(FuHpiCfuDevice *self, gint policy, gint nice, guint64 cpus);
+void
+fu_hpi_cfu_device_set_capture_directory(FuHpiCfuDevice *self, const gchar *capture_directory);
+void
+fu_hpi_cfu_device_set_skip_replug(FuHpiCfuDevice *self, gboolean skip_replug);
+gboolean
+fu_hpi_cfu_device_get_rebooting(FuHpiCfuDevice *self);
+void
+fu_hpi_cfu_device_cancel(FuHpiCfuDevice *self);
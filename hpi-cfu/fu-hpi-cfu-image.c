@@ -0,0 +1,463 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-cfu-struct.h"
+#include "fu-hpi-cfu-common.h"
+#include "fu-hpi-cfu-image.h"
+#include "fu-hpi-cfu-offer.h"
+#include "fu-hpi-cfu-payload.h"
+#include "fu-hpi-cfu-struct.h"
+
+/*
+ * The decoded form of one update archive: the offer and the complete stream of
+ * content reports, ready to be sent to the device as-is.
+ *
+ * Instances are shared between all the devices flashed with the same archive
+ * and so must never be modified after they have been packetized.
+ */
+struct _FuHpiCfuImage {
+	GObject parent_instance;
+	GBytes *offer;
+	GPtrArray *reports;  /* element-type GByteArray (FuStructHpiCfuPayloadCmd) */
+	FuFirmware *payload; /* (nullable): the parsed records, until packetized */
+	gsize payload_size;
+};
+
+G_DEFINE_TYPE(FuHpiCfuImage, fu_hpi_cfu_image, G_TYPE_OBJECT)
+
+GBytes *
+fu_hpi_cfu_image_get_offer(FuHpiCfuImage *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_IMAGE(self), NULL);
+	return self->offer;
+}
+
+GPtrArray *
+fu_hpi_cfu_image_get_reports(FuHpiCfuImage *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_IMAGE(self), NULL);
+	g_return_val_if_fail(self->payload == NULL, NULL);
+	return self->reports;
+}
+
+gboolean
+fu_hpi_cfu_image_is_packetized(FuHpiCfuImage *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_IMAGE(self), FALSE);
+	return self->payload == NULL;
+}
+
+gsize
+fu_hpi_cfu_image_get_payload_size(FuHpiCfuImage *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_IMAGE(self), 0);
+	return self->payload_size;
+}
+
+static gboolean
+fu_hpi_cfu_image_add_report(FuHpiCfuImage *self,
+			    const guint8 *buf,
+			    gsize bufsz,
+			    guint64 address,
+			    GError **error)
+{
+	g_autoptr(GByteArray) st_req = fu_struct_hpi_cfu_payload_cmd_new();
+
+	if (address + bufsz > (guint64)G_MAXUINT32 + 1) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_DATA,
+			    "payload too large, report at 0x%" G_GINT64_MODIFIER "x overflows",
+			    address);
+		return FALSE;
+	}
+
+	fu_struct_hpi_cfu_payload_cmd_set_report_id(st_req, FIRMWARE_REPORT_ID);
+	fu_struct_hpi_cfu_payload_cmd_set_length(st_req, bufsz);
+	/* the sequence number is only 16 bits and wraps from 0xFFFF back to 0x0000 */
+	fu_struct_hpi_cfu_payload_cmd_set_seq_number(st_req,
+						     (self->reports->len + 1) & G_MAXUINT16);
+	fu_struct_hpi_cfu_payload_cmd_set_address(st_req, (guint32)address);
+	if (!fu_struct_hpi_cfu_payload_cmd_set_data(st_req, buf, bufsz, error))
+		return FALSE;
+	g_ptr_array_add(self->reports, g_steal_pointer(&st_req));
+
+	/* success */
+	return TRUE;
+}
+
+/* one contiguous run of records, split into as many reports as required */
+static gboolean
+fu_hpi_cfu_image_add_run(FuHpiCfuImage *self, GByteArray *run, guint64 address, GError **error)
+{
+	for (gsize j = 0; j < run->len; j += FU_HPI_CFU_PAYLOAD_LENGTH) {
+		gsize chunksz = MIN(run->len - j, FU_HPI_CFU_PAYLOAD_LENGTH);
+		if (!fu_hpi_cfu_image_add_report(self, run->data + j, chunksz, address + j, error))
+			return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_image_add_records(FuHpiCfuImage *self, FuFirmware *fw_payload, GError **error)
+{
+	guint64 address = 0;
+	GByteArray *st_first;
+	GByteArray *st_last;
+	g_autoptr(GByteArray) run = g_byte_array_new();
+	g_autoptr(GPtrArray) records = NULL;
+
+	/* records are sent at their own address, and any that follow on directly from the
+	 * one before are merged so that only a gap starts a partly-filled report */
+	records = fu_firmware_get_chunks(fw_payload, error);
+	if (records == NULL)
+		return FALSE;
+	for (guint i = 0; i < records->len; i++) {
+		FuChunk *chk = g_ptr_array_index(records, i);
+		guint64 address_chk = fu_chunk_get_address(chk);
+
+		if (run->len > 0 && address_chk != address + run->len) {
+			if (!fu_hpi_cfu_image_add_run(self, run, address, error))
+				return FALSE;
+			g_byte_array_set_size(run, 0);
+		}
+		if (run->len == 0)
+			address = address_chk;
+		g_byte_array_append(run, fu_chunk_get_data(chk), fu_chunk_get_data_sz(chk));
+	}
+	if (run->len > 0) {
+		if (!fu_hpi_cfu_image_add_run(self, run, address, error))
+			return FALSE;
+	}
+	if (self->reports->len == 0) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_DATA,
+				    "payload has no records");
+		return FALSE;
+	}
+
+	/* mark the first and last blocks */
+	st_first = g_ptr_array_index(self->reports, 0);
+	fu_struct_hpi_cfu_payload_cmd_set_flags(st_first, FU_CFU_CONTENT_FLAG_FIRST_BLOCK);
+	st_last = g_ptr_array_index(self->reports, self->reports->len - 1);
+	fu_struct_hpi_cfu_payload_cmd_set_flags(st_last,
+						fu_struct_hpi_cfu_payload_cmd_get_flags(st_last) |
+						    FU_CFU_CONTENT_FLAG_LAST_BLOCK);
+
+	/* success */
+	return TRUE;
+}
+
+/* the reports were split at build time, so only check they are what the dock expects */
+static gboolean
+fu_hpi_cfu_image_load_reports(FuHpiCfuImage *self, GBytes *blob_reports, GError **error)
+{
+	gsize bufsz = 0;
+	gsize offset;
+	guint32 count;
+	guint32 crc;
+	const guint8 *buf = g_bytes_get_data(blob_reports, &bufsz);
+	g_autoptr(GByteArray) st_hdr = NULL;
+
+	st_hdr = fu_struct_hpi_cfu_reports_hdr_parse(buf, bufsz, 0x0, error);
+	if (st_hdr == NULL)
+		return FALSE;
+	if (fu_struct_hpi_cfu_reports_hdr_get_report_size(st_hdr) !=
+	    FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "reports have size %u, expected %u",
+			    fu_struct_hpi_cfu_reports_hdr_get_report_size(st_hdr),
+			    (guint)FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE);
+		return FALSE;
+	}
+	offset = st_hdr->len;
+	count = fu_struct_hpi_cfu_reports_hdr_get_count(st_hdr);
+	if (count == 0 || bufsz - offset != (gsize)count * FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "expected %u reports in 0x%x bytes",
+			    count,
+			    (guint)(bufsz - offset));
+		return FALSE;
+	}
+	crc = fu_crc32(FU_CRC_KIND_B32_STANDARD, buf + offset, bufsz - offset);
+	if (crc != fu_struct_hpi_cfu_reports_hdr_get_crc32(st_hdr)) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "reports checksum invalid, expected 0x%08x and got 0x%08x",
+			    fu_struct_hpi_cfu_reports_hdr_get_crc32(st_hdr),
+			    crc);
+		return FALSE;
+	}
+
+	for (guint32 i = 0; i < count; i++) {
+		g_autoptr(GByteArray) st_req = g_byte_array_new();
+
+		g_byte_array_append(st_req, buf + offset, FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE);
+		if (fu_struct_hpi_cfu_payload_cmd_get_report_id(st_req) != FIRMWARE_REPORT_ID ||
+		    fu_struct_hpi_cfu_payload_cmd_get_length(st_req) == 0 ||
+		    fu_struct_hpi_cfu_payload_cmd_get_length(st_req) > FU_HPI_CFU_PAYLOAD_LENGTH ||
+		    fu_struct_hpi_cfu_payload_cmd_get_seq_number(st_req) !=
+			((i + 1) & G_MAXUINT16)) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "report %u is invalid",
+				    i);
+			return FALSE;
+		}
+		g_ptr_array_add(self->reports, g_steal_pointer(&st_req));
+		offset += FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE;
+	}
+	self->payload_size = fu_struct_hpi_cfu_reports_hdr_get_payload_size(st_hdr);
+
+	/* success */
+	return TRUE;
+}
+
+/* images are matched on the prefix from the manifest, or on any name without one */
+static FuFirmware *
+fu_hpi_cfu_image_get_archive_image(FuFirmware *firmware,
+				   const gchar *prefix,
+				   const gchar *suffix,
+				   GError **error)
+{
+	g_autofree gchar *pattern = g_strdup_printf("%s%s", prefix != NULL ? prefix : "*", suffix);
+	return fu_archive_firmware_get_image_fnmatch(FU_ARCHIVE_FIRMWARE(firmware), pattern, error);
+}
+
+static gboolean
+fu_hpi_cfu_image_verify_payload(GBytes *blob_payload, GBytes *blob_manifest, GError **error)
+{
+	gsize bufsz = 0;
+	const gchar *buf = g_bytes_get_data(blob_manifest, &bufsz);
+	g_autofree gchar *manifest = g_strndup(buf, bufsz);
+	g_autofree gchar *checksum = NULL;
+	g_auto(GStrv) split = NULL;
+
+	/* same format as sha256sum, only the first field is used */
+	split = g_strsplit_set(g_strstrip(manifest), " \t\n", 2);
+	if (split[0] == NULL || strlen(split[0]) != 64) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "payload checksum manifest is invalid");
+		return FALSE;
+	}
+	checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob_payload);
+	if (g_ascii_strcasecmp(checksum, split[0]) != 0) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "payload checksum invalid, expected %s and got %s",
+			    split[0],
+			    checksum);
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+/* the prebuilt reports have to be exactly what the payload packetizes into */
+static gboolean
+fu_hpi_cfu_image_verify_reports(FuHpiCfuImage *self, FuFirmware *fw_payload, GError **error)
+{
+	g_autoptr(FuHpiCfuImage) image = g_object_new(FU_TYPE_HPI_CFU_IMAGE, NULL);
+
+	if (!fu_hpi_cfu_image_add_records(image, fw_payload, error))
+		return FALSE;
+	if (image->reports->len != self->reports->len) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "payload has %u reports but reports file has %u",
+			    image->reports->len,
+			    self->reports->len);
+		return FALSE;
+	}
+	for (guint i = 0; i < self->reports->len; i++) {
+		GByteArray *st_req = g_ptr_array_index(self->reports, i);
+		GByteArray *st_tmp = g_ptr_array_index(image->reports, i);
+		if (st_req->len != st_tmp->len ||
+		    memcmp(st_req->data, st_tmp->data, st_req->len) != 0) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "report %u does not match the payload",
+				    i);
+			return FALSE;
+		}
+	}
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_image_new_from_archive:
+ * @firmware: a #FuArchiveFirmware
+ * @prefix: (nullable): the name of the images without the extension, or %NULL for any
+ * @error: (nullable): optional return location for an error
+ *
+ * Extracts and validates the offer and payload from the archive. If the archive also
+ * contains a `*.payload.bin.sha256` manifest the payload is verified first. The payload
+ * records are only split into content reports by fu_hpi_cfu_image_packetize().
+ *
+ * If the archive contains a `*.reports.bin` the reports are validated and used as-is,
+ * and the payload is not needed at all. If there is a checksum manifest as well then the
+ * payload is required, verified, and has to packetize into exactly the same reports.
+ *
+ * Returns: (transfer full): a #FuHpiCfuImage, or %NULL on error
+ **/
+FuHpiCfuImage *
+fu_hpi_cfu_image_new_from_archive(FuFirmware *firmware, const gchar *prefix, GError **error)
+{
+	g_autoptr(FuHpiCfuImage) self = g_object_new(FU_TYPE_HPI_CFU_IMAGE, NULL);
+	g_autoptr(FuFirmware) fw_offer = NULL;
+	g_autoptr(FuFirmware) fw_payload = NULL;
+	g_autoptr(FuFirmware) fw_manifest = NULL;
+	g_autoptr(FuFirmware) fw_reports = NULL;
+	g_autoptr(FuFirmware) offer = fu_hpi_cfu_offer_new();
+	g_autoptr(FuFirmware) payload = fu_hpi_cfu_payload_new();
+	g_autoptr(GBytes) blob_offer = NULL;
+	g_autoptr(GBytes) blob_payload = NULL;
+
+	g_return_val_if_fail(FU_IS_ARCHIVE_FIRMWARE(firmware), NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	fw_offer = fu_hpi_cfu_image_get_archive_image(firmware, prefix, ".offer.bin", error);
+	if (fw_offer == NULL)
+		return NULL;
+	blob_offer = fu_firmware_get_bytes(fw_offer, error);
+	if (blob_offer == NULL)
+		return NULL;
+	if (!fu_firmware_parse_bytes(offer, blob_offer, 0x0, FU_FIRMWARE_PARSE_FLAG_NONE, error)) {
+		g_prefix_error(error, "failed to parse offer: ");
+		return NULL;
+	}
+	/* without any trailing data, which the parser has ignored */
+	self->offer = g_bytes_new_from_bytes(blob_offer, 0x0, FU_STRUCT_HPI_CFU_OFFER_SIZE);
+
+	/* already packetized when the archive was built */
+	fw_reports = fu_hpi_cfu_image_get_archive_image(firmware, prefix, ".reports.bin", NULL);
+	fw_manifest =
+	    fu_hpi_cfu_image_get_archive_image(firmware, prefix, ".payload.bin.sha256", NULL);
+	if (fw_reports != NULL) {
+		g_autoptr(GBytes) blob_reports = fu_firmware_get_bytes(fw_reports, error);
+		if (blob_reports == NULL)
+			return NULL;
+		if (!fu_hpi_cfu_image_load_reports(self, blob_reports, error)) {
+			g_prefix_error(error, "failed to load reports: ");
+			return NULL;
+		}
+		if (fw_manifest == NULL)
+			return g_steal_pointer(&self);
+	}
+
+	fw_payload = fu_hpi_cfu_image_get_archive_image(firmware, prefix, ".payload.bin", error);
+	if (fw_payload == NULL) {
+		if (fw_reports != NULL)
+			g_prefix_error(error, "reports cannot be verified: ");
+		return NULL;
+	}
+	blob_payload = fu_firmware_get_bytes(fw_payload, error);
+	if (blob_payload == NULL)
+		return NULL;
+
+	/* optional, but catches a corrupt payload before the transfer rather than after */
+	if (fw_manifest != NULL) {
+		g_autoptr(GBytes) blob_manifest = fu_firmware_get_bytes(fw_manifest, error);
+		if (blob_manifest == NULL)
+			return NULL;
+		if (!fu_hpi_cfu_image_verify_payload(blob_payload, blob_manifest, error))
+			return NULL;
+	}
+
+	if (!fu_firmware_parse_bytes(payload,
+				     blob_payload,
+				     0x0,
+				     FU_FIRMWARE_PARSE_FLAG_NONE,
+				     error)) {
+		g_prefix_error(error, "failed to parse payload: ");
+		return NULL;
+	}
+	if (fw_reports != NULL) {
+		if (!fu_hpi_cfu_image_verify_reports(self, payload, error))
+			return NULL;
+		return g_steal_pointer(&self);
+	}
+	self->payload_size = g_bytes_get_size(blob_payload);
+	self->payload = g_steal_pointer(&payload);
+
+	/* success */
+	return g_steal_pointer(&self);
+}
+
+/**
+ * fu_hpi_cfu_image_packetize:
+ * @self: a #FuHpiCfuImage
+ * @error: (nullable): optional return location for an error
+ *
+ * Splits the payload records into the content reports that are sent to the device,
+ * unless this has already been done. The payload has already been validated, so this
+ * can be done on another thread while the device is busy.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+fu_hpi_cfu_image_packetize(FuHpiCfuImage *self, GError **error)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_IMAGE(self), FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (self->payload == NULL)
+		return TRUE;
+	if (!fu_hpi_cfu_image_add_records(self, self->payload, error)) {
+		g_ptr_array_set_size(self->reports, 0);
+		return FALSE;
+	}
+	g_clear_object(&self->payload);
+
+	/* success */
+	return TRUE;
+}
+
+static void
+fu_hpi_cfu_image_init(FuHpiCfuImage *self)
+{
+	self->reports = g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+}
+
+static void
+fu_hpi_cfu_image_finalize(GObject *object)
+{
+	FuHpiCfuImage *self = FU_HPI_CFU_IMAGE(object);
+
+	if (self->offer != NULL)
+		g_bytes_unref(self->offer);
+	if (self->payload != NULL)
+		g_object_unref(self->payload);
+	g_ptr_array_unref(self->reports);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_image_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_image_class_init(FuHpiCfuImageClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = fu_hpi_cfu_image_finalize;
+}
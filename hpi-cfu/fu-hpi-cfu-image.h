@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_IMAGE (fu_hpi_cfu_image_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuImage, fu_hpi_cfu_image, FU, HPI_CFU_IMAGE, GObject)
+
+FuHpiCfuImage *
+fu_hpi_cfu_image_new_from_archive(FuFirmware *firmware, const gchar *prefix, GError **error);
+gboolean
+fu_hpi_cfu_image_packetize(FuHpiCfuImage *self, GError **error);
+gboolean
+fu_hpi_cfu_image_is_packetized(FuHpiCfuImage *self);
+GBytes *
+fu_hpi_cfu_image_get_offer(FuHpiCfuImage *self);
+GPtrArray *
+fu_hpi_cfu_image_get_reports(FuHpiCfuImage *self);
+gsize
+fu_hpi_cfu_image_get_payload_size(FuHpiCfuImage *self);
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-hpi-cfu-manifest.h"
+
+/*
+ * Maps each model, revision and component of an archive that serves several docks to the
+ * prefix of its images, e.g.
+ *
+ *   [fleetwood]
+ *   Pid=0x0BAF
+ *   Images=fleetwood
+ *
+ *   [hendrix-rev2]
+ *   Pid=0x03B7
+ *   Revision=0x0002
+ *   ComponentId=0x01
+ *   Images=hendrix-0002-bank0
+ *   AlternateImages=hendrix-0002-bank1
+ *
+ * The revision and component ID are optional and match anything when omitted. The
+ * alternate images are linked for the other flash bank of a dual-bank dock, and are
+ * only offered if the dock rejects the first offer for the bank.
+ */
+typedef struct {
+	gchar *images;
+	gchar *alternate_images; /* (nullable) */
+} FuHpiCfuManifestEntry;
+
+struct _FuHpiCfuManifest {
+	GObject parent_instance;
+	GHashTable *index; /* pid:rev:component_id, each hex or `*` -> FuHpiCfuManifestEntry */
+};
+
+G_DEFINE_TYPE(FuHpiCfuManifest, fu_hpi_cfu_manifest, G_TYPE_OBJECT)
+
+static void
+fu_hpi_cfu_manifest_entry_free(FuHpiCfuManifestEntry *entry)
+{
+	g_free(entry->images);
+	g_free(entry->alternate_images);
+	g_free(entry);
+}
+
+static gchar *
+fu_hpi_cfu_manifest_build_key(guint16 pid, gint rev, gint component_id)
+{
+	g_autofree gchar *rev_str =
+	    rev >= 0 ? g_strdup_printf("%04X", (guint)rev) : g_strdup("*");
+	g_autofree gchar *component_str =
+	    component_id >= 0 ? g_strdup_printf("%02X", (guint)component_id) : g_strdup("*");
+	return g_strdup_printf("%04X:%s:%s", pid, rev_str, component_str);
+}
+
+/* @value is set to -1 if the key is missing */
+static gboolean
+fu_hpi_cfu_manifest_get_integer(GKeyFile *kf,
+				const gchar *group,
+				const gchar *key,
+				guint64 max,
+				gint *value,
+				GError **error)
+{
+	guint64 tmp = 0;
+	g_autofree gchar *str = g_key_file_get_string(kf, group, key, NULL);
+
+	if (str == NULL) {
+		*value = -1;
+		return TRUE;
+	}
+	if (!fu_strtoull(str, &tmp, 0, max, FU_INTEGER_BASE_AUTO, error)) {
+		g_prefix_error(error, "invalid %s in [%s]: ", key, group);
+		return FALSE;
+	}
+	*value = (gint)tmp;
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_manifest_add_entry(FuHpiCfuManifest *self,
+			      GKeyFile *kf,
+			      const gchar *group,
+			      GError **error)
+{
+	gint pid = -1;
+	gint rev = -1;
+	gint component_id = -1;
+	FuHpiCfuManifestEntry *entry;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *prefix = NULL;
+
+	if (!fu_hpi_cfu_manifest_get_integer(kf, group, "Pid", G_MAXUINT16, &pid, error))
+		return FALSE;
+	if (pid < 0) {
+		g_set_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_FILE, "no Pid in [%s]", group);
+		return FALSE;
+	}
+	if (!fu_hpi_cfu_manifest_get_integer(kf, group, "Revision", G_MAXUINT16, &rev, error))
+		return FALSE;
+	if (!fu_hpi_cfu_manifest_get_integer(kf,
+					     group,
+					     "ComponentId",
+					     G_MAXUINT8,
+					     &component_id,
+					     error))
+		return FALSE;
+	prefix = g_key_file_get_string(kf, group, "Images", NULL);
+	if (prefix == NULL) {
+		g_set_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_FILE, "no Images in [%s]", group);
+		return FALSE;
+	}
+
+	key = fu_hpi_cfu_manifest_build_key(pid, rev, component_id);
+	if (g_hash_table_contains(self->index, key)) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "[%s] duplicates the match of another entry",
+			    group);
+		return FALSE;
+	}
+	entry = g_new0(FuHpiCfuManifestEntry, 1);
+	entry->images = g_steal_pointer(&prefix);
+	entry->alternate_images = g_key_file_get_string(kf, group, "AlternateImages", NULL);
+	g_hash_table_insert(self->index, g_steal_pointer(&key), entry);
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_manifest_lookup:
+ * @self: a #FuHpiCfuManifest
+ * @pid: USB product ID
+ * @rev: USB release number
+ * @component_id: CFU component ID
+ * @alternate_images: (out) (optional): the prefix of the images for the other bank, if any
+ *
+ * Finds the images for a device, preferring the entry that matches the most fields.
+ *
+ * Returns: the prefix of the images, or %NULL if the archive has none for the device
+ **/
+const gchar *
+fu_hpi_cfu_manifest_lookup(FuHpiCfuManifest *self,
+			   guint16 pid,
+			   guint16 rev,
+			   guint8 component_id,
+			   const gchar **alternate_images)
+{
+	const gint revs[] = {rev, rev, -1, -1};
+	const gint component_ids[] = {component_id, -1, component_id, -1};
+
+	g_return_val_if_fail(FU_IS_HPI_CFU_MANIFEST(self), NULL);
+
+	for (guint i = 0; i < G_N_ELEMENTS(revs); i++) {
+		g_autofree gchar *key = fu_hpi_cfu_manifest_build_key(pid, revs[i], component_ids[i]);
+		FuHpiCfuManifestEntry *entry = g_hash_table_lookup(self->index, key);
+		if (entry != NULL) {
+			if (alternate_images != NULL)
+				*alternate_images = entry->alternate_images;
+			return entry->images;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * fu_hpi_cfu_manifest_new_from_bytes:
+ * @blob: the manifest from the archive
+ * @error: (nullable): optional return location for an error
+ *
+ * Parses and indexes the manifest so each device can find its images with one lookup.
+ *
+ * Returns: (transfer full): a #FuHpiCfuManifest, or %NULL on error
+ **/
+FuHpiCfuManifest *
+fu_hpi_cfu_manifest_new_from_bytes(GBytes *blob, GError **error)
+{
+	gsize bufsz = 0;
+	const gchar *buf = g_bytes_get_data(blob, &bufsz);
+	g_autoptr(FuHpiCfuManifest) self = g_object_new(FU_TYPE_HPI_CFU_MANIFEST, NULL);
+	g_autoptr(GKeyFile) kf = g_key_file_new();
+	g_auto(GStrv) groups = NULL;
+
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!g_key_file_load_from_data(kf, buf, bufsz, G_KEY_FILE_NONE, error)) {
+		fwupd_error_convert(error);
+		return NULL;
+	}
+	groups = g_key_file_get_groups(kf, NULL);
+	for (guint i = 0; groups[i] != NULL; i++) {
+		if (!fu_hpi_cfu_manifest_add_entry(self, kf, groups[i], error))
+			return NULL;
+	}
+	if (g_hash_table_size(self->index) == 0) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "manifest has no entries");
+		return NULL;
+	}
+
+	/* success */
+	return g_steal_pointer(&self);
+}
+
+static void
+fu_hpi_cfu_manifest_init(FuHpiCfuManifest *self)
+{
+	self->index = g_hash_table_new_full(g_str_hash,
+					    g_str_equal,
+					    g_free,
+					    (GDestroyNotify)fu_hpi_cfu_manifest_entry_free);
+}
+
+static void
+fu_hpi_cfu_manifest_finalize(GObject *object)
+{
+	FuHpiCfuManifest *self = FU_HPI_CFU_MANIFEST(object);
+
+	g_hash_table_unref(self->index);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_manifest_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_manifest_class_init(FuHpiCfuManifestClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = fu_hpi_cfu_manifest_finalize;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_MANIFEST (fu_hpi_cfu_manifest_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuManifest, fu_hpi_cfu_manifest, FU, HPI_CFU_MANIFEST, GObject)
+
+FuHpiCfuManifest *
+fu_hpi_cfu_manifest_new_from_bytes(GBytes *blob, GError **error);
+const gchar *
+fu_hpi_cfu_manifest_lookup(FuHpiCfuManifest *self,
+			   guint16 pid,
+			   guint16 rev,
+			   guint8 component_id,
+			   const gchar **alternate_images);
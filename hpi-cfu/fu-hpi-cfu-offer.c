@@ -0,0 +1,168 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-hpi-cfu-offer.h"
+#include "fu-hpi-cfu-struct.h"
+
+/* component IDs reserved for the offer information and offer command packets */
+#define FU_HPI_CFU_OFFER_COMPONENT_ID_COMMAND 0xFE
+#define FU_HPI_CFU_OFFER_COMPONENT_ID_INFO    0xFF
+
+struct _FuHpiCfuOffer {
+	FuFirmware parent_instance;
+	guint8 segment_number;
+	guint8 component_id;
+	guint8 token;
+	guint8 protocol_version;
+	guint16 product_specific;
+};
+
+G_DEFINE_TYPE(FuHpiCfuOffer, fu_hpi_cfu_offer, FU_TYPE_FIRMWARE)
+
+static void
+fu_hpi_cfu_offer_export(FuFirmware *firmware, FuFirmwareExportFlags flags, XbBuilderNode *bn)
+{
+	FuHpiCfuOffer *self = FU_HPI_CFU_OFFER(firmware);
+	fu_xmlb_builder_insert_kx(bn, "segment_number", self->segment_number);
+	fu_xmlb_builder_insert_kx(bn, "component_id", self->component_id);
+	fu_xmlb_builder_insert_kx(bn, "token", self->token);
+	fu_xmlb_builder_insert_kx(bn, "protocol_version", self->protocol_version);
+	fu_xmlb_builder_insert_kx(bn, "product_specific", self->product_specific);
+}
+
+static gboolean
+fu_hpi_cfu_offer_parse(FuFirmware *firmware,
+		       GInputStream *stream,
+		       FuFirmwareParseFlags flags,
+		       GError **error)
+{
+	FuHpiCfuOffer *self = FU_HPI_CFU_OFFER(firmware);
+	gsize streamsz = 0;
+	guint32 version_raw;
+	g_autofree gchar *version = NULL;
+	g_autoptr(GByteArray) st = NULL;
+
+	/* only the struct is sent to the device, older archives may have padding after it */
+	if (!fu_input_stream_size(stream, &streamsz, error))
+		return FALSE;
+	if (streamsz > FU_STRUCT_HPI_CFU_OFFER_SIZE) {
+		g_debug("ignoring 0x%x bytes of data after the offer",
+			(guint)(streamsz - FU_STRUCT_HPI_CFU_OFFER_SIZE));
+	}
+	st = fu_struct_hpi_cfu_offer_parse_stream(stream, 0x0, error);
+	if (st == NULL)
+		return FALSE;
+
+	self->segment_number = fu_struct_hpi_cfu_offer_get_segment_number(st);
+	self->component_id = fu_struct_hpi_cfu_offer_get_component_id(st);
+	if (self->component_id == FU_HPI_CFU_OFFER_COMPONENT_ID_COMMAND ||
+	    self->component_id == FU_HPI_CFU_OFFER_COMPONENT_ID_INFO) {
+		g_set_error(error,
+			    FWUPD_ERROR,
+			    FWUPD_ERROR_INVALID_FILE,
+			    "offer component ID 0x%02x is reserved",
+			    self->component_id);
+		return FALSE;
+	}
+	self->token = fu_struct_hpi_cfu_offer_get_token(st);
+	self->protocol_version = fu_struct_hpi_cfu_offer_get_protocol_version(st);
+	self->product_specific = fu_struct_hpi_cfu_offer_get_product_specific(st);
+
+	/* same layout as the version table entry */
+	version_raw = ((guint32)fu_struct_hpi_cfu_offer_get_major_version(st) << 24) |
+		      ((guint32)fu_struct_hpi_cfu_offer_get_minor_version(st) << 8) |
+		      fu_struct_hpi_cfu_offer_get_variant(st);
+	version = g_strdup_printf("%02x.%02x.%02x.%02x",
+				  (version_raw >> 24) & 0xff,
+				  (version_raw >> 16) & 0xff,
+				  (version_raw >> 8) & 0xff,
+				  version_raw & 0xff);
+	fu_firmware_set_version_raw(firmware, version_raw);
+	fu_firmware_set_version(firmware, version);
+
+	/* success */
+	return TRUE;
+}
+
+guint8
+fu_hpi_cfu_offer_get_component_id(FuHpiCfuOffer *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_OFFER(self), 0x0);
+	return self->component_id;
+}
+
+guint8
+fu_hpi_cfu_offer_get_token(FuHpiCfuOffer *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_OFFER(self), 0x0);
+	return self->token;
+}
+
+/* the offer flags to use for an install, given the force-version, force-reset and
+ * deferred-activation device flags */
+guint8
+fu_hpi_cfu_offer_flags_for_install(FwupdInstallFlags install_flags,
+				   gboolean force_version,
+				   gboolean force_reset,
+				   gboolean deferred)
+{
+	guint8 flags = FU_HPI_CFU_OFFER_FLAG_NONE;
+
+	/* only when asked, otherwise the dock skips a version it already runs */
+	if ((install_flags & FWUPD_INSTALL_FLAG_FORCE) > 0 || force_version)
+		flags |= FU_HPI_CFU_OFFER_FLAG_FORCE_IGNORE_VERSION;
+
+	/* a staged image is only swapped in by ->activate */
+	if (((install_flags & FWUPD_INSTALL_FLAG_FORCE) > 0 || force_reset) && !deferred)
+		flags |= FU_HPI_CFU_OFFER_FLAG_FORCE_IMMEDIATE_RESET;
+	return flags;
+}
+
+/* the offer command report for @blob, with the force bits set only from @flags */
+GByteArray *
+fu_hpi_cfu_offer_build_cmd(GBytes *blob, guint8 flags, GError **error)
+{
+	gsize bufsz = 0;
+	const guint8 *buf = g_bytes_get_data(blob, &bufsz);
+	g_autoptr(GByteArray) st = fu_struct_hpi_cfu_offer_cmd_new();
+
+	if (!fu_memcpy_safe(st->data,
+			    st->len,
+			    0x1,
+			    buf,
+			    bufsz,
+			    0x0,
+			    FU_STRUCT_HPI_CFU_OFFER_SIZE,
+			    error))
+		return NULL;
+	fu_struct_hpi_cfu_offer_cmd_set_flags(
+	    st,
+	    (fu_struct_hpi_cfu_offer_cmd_get_flags(st) & ~FU_HPI_CFU_OFFER_FLAG_MASK_FORCE) |
+		(flags & FU_HPI_CFU_OFFER_FLAG_MASK_FORCE));
+	return g_steal_pointer(&st);
+}
+
+static void
+fu_hpi_cfu_offer_init(FuHpiCfuOffer *self)
+{
+	fu_firmware_add_flag(FU_FIRMWARE(self), FU_FIRMWARE_FLAG_NO_AUTO_DETECTION);
+}
+
+static void
+fu_hpi_cfu_offer_class_init(FuHpiCfuOfferClass *klass)
+{
+	FuFirmwareClass *firmware_class = FU_FIRMWARE_CLASS(klass);
+	firmware_class->parse = fu_hpi_cfu_offer_parse;
+	firmware_class->export = fu_hpi_cfu_offer_export;
+}
+
+FuFirmware *
+fu_hpi_cfu_offer_new(void)
+{
+	return FU_FIRMWARE(g_object_new(FU_TYPE_HPI_CFU_OFFER, NULL));
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_OFFER (fu_hpi_cfu_offer_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuOffer, fu_hpi_cfu_offer, FU, HPI_CFU_OFFER, FuFirmware)
+
+/* the force bits of the offer flags, which are set per install and never from the archive */
+#define FU_HPI_CFU_OFFER_FLAG_MASK_FORCE 0xC0
+
+FuFirmware *
+fu_hpi_cfu_offer_new(void);
+guint8
+fu_hpi_cfu_offer_get_component_id(FuHpiCfuOffer *self);
+guint8
+fu_hpi_cfu_offer_get_token(FuHpiCfuOffer *self);
+guint8
+fu_hpi_cfu_offer_flags_for_install(FwupdInstallFlags install_flags,
+				   gboolean force_version,
+				   gboolean force_reset,
+				   gboolean deferred);
+GByteArray *
+fu_hpi_cfu_offer_build_cmd(GBytes *blob, guint8 flags, GError **error);
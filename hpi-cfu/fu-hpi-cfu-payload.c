@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-hpi-cfu-payload.h"
+#include "fu-hpi-cfu-struct.h"
+
+/*
+ * The payload is a list of records, each with an address and a length header
+ * followed by the data. Every record is added as a #FuChunk so that the
+ * content reports can be built without parsing the payload again.
+ */
+struct _FuHpiCfuPayload {
+	FuFirmware parent_instance;
+};
+
+G_DEFINE_TYPE(FuHpiCfuPayload, fu_hpi_cfu_payload, FU_TYPE_FIRMWARE)
+
+static gboolean
+fu_hpi_cfu_payload_parse(FuFirmware *firmware,
+			 GInputStream *stream,
+			 FuFirmwareParseFlags flags,
+			 GError **error)
+{
+	gsize offset = 0;
+	gsize streamsz = 0;
+	guint idx = 0;
+
+	if (!fu_input_stream_size(stream, &streamsz, error))
+		return FALSE;
+	while (offset < streamsz) {
+		guint32 address;
+		guint8 record_length;
+		g_autoptr(FuChunk) chk = NULL;
+		g_autoptr(GByteArray) st = NULL;
+		g_autoptr(GBytes) blob = NULL;
+
+		st = fu_struct_hpi_cfu_payload_record_parse_stream(stream, offset, error);
+		if (st == NULL) {
+			g_prefix_error(error, "failed to parse record at 0x%x: ", (guint)offset);
+			return FALSE;
+		}
+		address = fu_struct_hpi_cfu_payload_record_get_address(st);
+		record_length = fu_struct_hpi_cfu_payload_record_get_length(st);
+		if (record_length == 0) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "record at 0x%x has zero length",
+				    (guint)offset);
+			return FALSE;
+		}
+		offset += st->len;
+		if (offset + record_length > streamsz) {
+			g_set_error(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "record at 0x%x overruns the payload",
+				    (guint)(offset - st->len));
+			return FALSE;
+		}
+		blob = fu_input_stream_read_bytes(stream, offset, record_length, NULL, error);
+		if (blob == NULL)
+			return FALSE;
+		chk = fu_chunk_bytes_new(blob);
+		fu_chunk_set_idx(chk, idx++);
+		fu_chunk_set_address(chk, address);
+		fu_firmware_add_chunk(firmware, chk);
+		offset += record_length;
+	}
+	if (idx == 0) {
+		g_set_error_literal(error,
+				    FWUPD_ERROR,
+				    FWUPD_ERROR_INVALID_FILE,
+				    "payload has no records");
+		return FALSE;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static void
+fu_hpi_cfu_payload_init(FuHpiCfuPayload *self)
+{
+	fu_firmware_add_flag(FU_FIRMWARE(self), FU_FIRMWARE_FLAG_NO_AUTO_DETECTION);
+}
+
+static void
+fu_hpi_cfu_payload_class_init(FuHpiCfuPayloadClass *klass)
+{
+	FuFirmwareClass *firmware_class = FU_FIRMWARE_CLASS(klass);
+	firmware_class->parse = fu_hpi_cfu_payload_parse;
+}
+
+FuFirmware *
+fu_hpi_cfu_payload_new(void)
+{
+	return FU_FIRMWARE(g_object_new(FU_TYPE_HPI_CFU_PAYLOAD, NULL));
+}
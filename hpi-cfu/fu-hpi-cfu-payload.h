@@ -0,0 +1,15 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_PAYLOAD (fu_hpi_cfu_payload_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuPayload, fu_hpi_cfu_payload, FU, HPI_CFU_PAYLOAD, FuFirmware)
+
+FuFirmware *
+fu_hpi_cfu_payload_new(void);
@@ -6,18 +6,275 @@
 
 #include "config.h"
 
+#include <sched.h>
+
 #include "fu-hpi-cfu-device.h"
+#include "fu-hpi-cfu-image.h"
+#include "fu-hpi-cfu-offer.h"
+#include "fu-hpi-cfu-payload.h"
 #include "fu-hpi-cfu-plugin.h"
 
 struct _FuHpiCfuPlugin {
 	FuPlugin parent_instance;
+	GHashTable *image_cache; /* checksum:FuHpiCfuImage */
+	guint64 max_transfer_rate;
+	gint worker_policy;
+	gint worker_nice;
+	guint64 worker_cpus;
+	gchar *capture_directory; /* (nullable) */
 };
 
 G_DEFINE_TYPE(FuHpiCfuPlugin, fu_hpi_cfu_plugin, FU_TYPE_PLUGIN)
 
+/* the sysfs name of the USB device, e.g. 1-2.3 */
+static gchar *
+fu_hpi_cfu_plugin_get_port_path(FuDevice *device)
+{
+	const gchar *backend_id = fu_device_get_backend_id(device);
+	if (backend_id == NULL)
+		return NULL;
+	return g_path_get_basename(backend_id);
+}
+
+/* the number of hubs between the root port and the device, e.g. 1-2.3 is 2 */
+static guint
+fu_hpi_cfu_plugin_get_port_depth(const gchar *port_path)
+{
+	const gchar *tmp = strchr(port_path, '-');
+	guint depth = 1;
+
+	if (tmp == NULL)
+		return 0;
+	for (; *tmp != '\0'; tmp++) {
+		if (*tmp == '.')
+			depth++;
+	}
+	return depth;
+}
+
+/* is the device behind the upstream dock, e.g. 1-2.3.1 is behind 1-2.3 but 1-2.4 is a sibling */
+static gboolean
+fu_hpi_cfu_plugin_is_downstream(const gchar *port_path, const gchar *port_path_upstream)
+{
+	g_autofree gchar *prefix = g_strdup_printf("%s.", port_path_upstream);
+	return g_str_has_prefix(port_path, prefix);
+}
+
+static void
+fu_hpi_cfu_plugin_device_registered(FuPlugin *plugin, FuDevice *device)
+{
+	g_autofree gchar *port_path = NULL;
+
+	if (!FU_IS_HPI_CFU_DEVICE(device))
+		return;
+
+	/* a dock reboot takes down everything behind it, so update downstream first */
+	port_path = fu_hpi_cfu_plugin_get_port_path(device);
+	if (port_path == NULL)
+		return;
+	g_debug("%s is at %s", fu_device_get_id(device), port_path);
+	fu_device_set_order(device, -(gint)fu_hpi_cfu_plugin_get_port_depth(port_path));
+}
+
+static void
+fu_hpi_cfu_plugin_device_removed(FuPlugin *plugin, FuDevice *device)
+{
+	/* do not wait for a transfer timeout on a dock that has gone */
+	if (FU_IS_HPI_CFU_DEVICE(device))
+		fu_hpi_cfu_device_cancel(FU_HPI_CFU_DEVICE(device));
+}
+
+/* the other docks in the batch that @device is behind */
+static GPtrArray *
+fu_hpi_cfu_plugin_get_upstream_devices(GPtrArray *devices, FuDevice *device)
+{
+	g_autofree gchar *port_path = fu_hpi_cfu_plugin_get_port_path(device);
+	g_autoptr(GPtrArray) upstreams = g_ptr_array_new();
+
+	if (port_path == NULL)
+		return g_steal_pointer(&upstreams);
+	for (guint i = 0; i < devices->len; i++) {
+		FuDevice *device_tmp = g_ptr_array_index(devices, i);
+		g_autofree gchar *port_path_tmp = NULL;
+
+		if (device_tmp == device || !FU_IS_HPI_CFU_DEVICE(device_tmp))
+			continue;
+		port_path_tmp = fu_hpi_cfu_plugin_get_port_path(device_tmp);
+		if (port_path_tmp == NULL)
+			continue;
+		if (fu_hpi_cfu_plugin_is_downstream(port_path, port_path_tmp)) {
+			g_debug("%s is downstream of %s", port_path, port_path_tmp);
+			g_ptr_array_add(upstreams, device_tmp);
+		}
+	}
+	return g_steal_pointer(&upstreams);
+}
+
+static gboolean
+fu_hpi_cfu_plugin_composite_prepare(FuPlugin *plugin, GPtrArray *devices, GError **error)
+{
+	for (guint i = 0; i < devices->len; i++) {
+		FuDevice *device = g_ptr_array_index(devices, i);
+		g_autoptr(GPtrArray) upstreams = NULL;
+
+		if (!FU_IS_HPI_CFU_DEVICE(device))
+			continue;
+
+		/* the upstream dock reboot brings this one back anyway */
+		upstreams = fu_hpi_cfu_plugin_get_upstream_devices(devices, device);
+		if (upstreams->len > 0)
+			fu_hpi_cfu_device_set_skip_replug(FU_HPI_CFU_DEVICE(device), TRUE);
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_plugin_composite_cleanup(FuPlugin *plugin, GPtrArray *devices, GError **error)
+{
+	for (guint i = 0; i < devices->len; i++) {
+		FuDevice *device = g_ptr_array_index(devices, i);
+		gboolean upstream_rebooting = FALSE;
+		g_autoptr(GPtrArray) upstreams = NULL;
+
+		if (!FU_IS_HPI_CFU_DEVICE(device))
+			continue;
+		fu_hpi_cfu_device_set_skip_replug(FU_HPI_CFU_DEVICE(device), FALSE);
+
+		/* the upstream install failed or was not needed, so wait for this one after all */
+		if (!fu_hpi_cfu_device_get_rebooting(FU_HPI_CFU_DEVICE(device)))
+			continue;
+		upstreams = fu_hpi_cfu_plugin_get_upstream_devices(devices, device);
+		if (upstreams->len == 0)
+			continue;
+		for (guint j = 0; j < upstreams->len; j++) {
+			FuDevice *upstream = g_ptr_array_index(upstreams, j);
+			if (fu_hpi_cfu_device_get_rebooting(FU_HPI_CFU_DEVICE(upstream)))
+				upstream_rebooting = TRUE;
+		}
+		if (!upstream_rebooting) {
+			g_info("%s: no upstream dock rebooted, waiting for replug",
+			       fu_device_get_id(device));
+			fu_device_add_flag(device, FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG);
+		}
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_plugin_device_created(FuPlugin *plugin, FuDevice *device, GError **error)
+{
+	FuHpiCfuPlugin *self = FU_HPI_CFU_PLUGIN(plugin);
+
+	/* all the docks share the decoded archive */
+	if (FU_IS_HPI_CFU_DEVICE(device)) {
+		fu_hpi_cfu_device_set_image_cache(FU_HPI_CFU_DEVICE(device), self->image_cache);
+		fu_hpi_cfu_device_set_max_transfer_rate(FU_HPI_CFU_DEVICE(device),
+							self->max_transfer_rate);
+		fu_hpi_cfu_device_set_worker_scheduling(FU_HPI_CFU_DEVICE(device),
+							self->worker_policy,
+							self->worker_nice,
+							self->worker_cpus);
+		fu_hpi_cfu_device_set_capture_directory(FU_HPI_CFU_DEVICE(device),
+							self->capture_directory);
+	}
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_plugin_parse_worker_policy(const gchar *str, gint *policy, GError **error)
+{
+	if (g_strcmp0(str, "other") == 0) {
+		*policy = SCHED_OTHER;
+		return TRUE;
+	}
+#ifdef SCHED_BATCH
+	if (g_strcmp0(str, "batch") == 0) {
+		*policy = SCHED_BATCH;
+		return TRUE;
+	}
+#endif
+	if (g_strcmp0(str, "fifo") == 0) {
+		*policy = SCHED_FIFO;
+		return TRUE;
+	}
+	if (g_strcmp0(str, "rr") == 0) {
+		*policy = SCHED_RR;
+		return TRUE;
+	}
+	g_set_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_DATA, "unknown policy %s", str);
+	return FALSE;
+}
+
+/* a comma separated list of CPU numbers, e.g. 2,3 */
+static gboolean
+fu_hpi_cfu_plugin_parse_worker_cpus(const gchar *str, guint64 *cpus, GError **error)
+{
+	g_auto(GStrv) split = g_strsplit(str, ",", -1);
+
+	*cpus = 0;
+	for (guint i = 0; split[i] != NULL; i++) {
+		guint64 cpu = 0;
+		if (split[i][0] == '\0')
+			continue;
+		if (!fu_strtoull(split[i], &cpu, 0, 63, FU_INTEGER_BASE_10, error))
+			return FALSE;
+		*cpus |= 1ull << cpu;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_plugin_startup(FuPlugin *plugin, FuProgress *progress, GError **error)
+{
+	FuHpiCfuPlugin *self = FU_HPI_CFU_PLUGIN(plugin);
+	gint64 nice = 0;
+	g_autofree gchar *capture = fu_plugin_get_config_value(plugin, "CaptureDirectory");
+	g_autofree gchar *cpus = fu_plugin_get_config_value(plugin, "WorkerCpus");
+	g_autofree gchar *nice_str = fu_plugin_get_config_value(plugin, "WorkerNice");
+	g_autofree gchar *policy = fu_plugin_get_config_value(plugin, "WorkerPolicy");
+	g_autofree gchar *rate = fu_plugin_get_config_value(plugin, "MaxTransferRate");
+
+	if (!fu_strtoull(rate,
+			 &self->max_transfer_rate,
+			 0,
+			 G_MAXUINT32,
+			 FU_INTEGER_BASE_AUTO,
+			 error)) {
+		g_prefix_error(error, "invalid MaxTransferRate: ");
+		return FALSE;
+	}
+	if (!fu_hpi_cfu_plugin_parse_worker_policy(policy, &self->worker_policy, error)) {
+		g_prefix_error(error, "invalid WorkerPolicy: ");
+		return FALSE;
+	}
+	if (!fu_strtoll(nice_str, &nice, -20, 19, FU_INTEGER_BASE_10, error)) {
+		g_prefix_error(error, "invalid WorkerNice: ");
+		return FALSE;
+	}
+	self->worker_nice = (gint)nice;
+	if (!fu_hpi_cfu_plugin_parse_worker_cpus(cpus, &self->worker_cpus, error)) {
+		g_prefix_error(error, "invalid WorkerCpus: ");
+		return FALSE;
+	}
+	g_clear_pointer(&self->capture_directory, g_free);
+	if (capture != NULL && capture[0] != '\0')
+		self->capture_directory = g_steal_pointer(&capture);
+
+	/* success */
+	return TRUE;
+}
+
 static void
 fu_hpi_cfu_plugin_init(FuHpiCfuPlugin *self)
 {
+	self->image_cache =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_object_unref);
 }
 
 static void
@@ -26,11 +283,38 @@ fu_hpi_cfu_plugin_constructed(GObject *obj)
 	FuPlugin *plugin = FU_PLUGIN(obj);
 	// FuContext *ctx = fu_plugin_get_context(plugin);
 	fu_plugin_add_device_gtype(plugin, FU_TYPE_HPI_CFU_DEVICE);
+	fu_plugin_add_firmware_gtype(plugin, NULL, FU_TYPE_HPI_CFU_OFFER);
+	fu_plugin_add_firmware_gtype(plugin, NULL, FU_TYPE_HPI_CFU_PAYLOAD);
+	fu_plugin_set_config_default(plugin, "CaptureDirectory", "");
+	fu_plugin_set_config_default(plugin, "MaxTransferRate", "0");
+	fu_plugin_set_config_default(plugin, "WorkerCpus", "");
+	fu_plugin_set_config_default(plugin, "WorkerNice", "0");
+	fu_plugin_set_config_default(plugin, "WorkerPolicy", "other");
+}
+
+static void
+fu_hpi_cfu_plugin_finalize(GObject *obj)
+{
+	FuHpiCfuPlugin *self = FU_HPI_CFU_PLUGIN(obj);
+
+	g_hash_table_unref(self->image_cache);
+	g_free(self->capture_directory);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_plugin_parent_class)->finalize(obj);
 }
 
 static void
 fu_hpi_cfu_plugin_class_init(FuHpiCfuPluginClass *klass)
 {
 	FuPluginClass *plugin_class = FU_PLUGIN_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->finalize = fu_hpi_cfu_plugin_finalize;
 	plugin_class->constructed = fu_hpi_cfu_plugin_constructed;
+	plugin_class->startup = fu_hpi_cfu_plugin_startup;
+	plugin_class->device_created = fu_hpi_cfu_plugin_device_created;
+	plugin_class->device_registered = fu_hpi_cfu_plugin_device_registered;
+	plugin_class->device_removed = fu_hpi_cfu_plugin_device_removed;
+	plugin_class->composite_prepare = fu_hpi_cfu_plugin_composite_prepare;
+	plugin_class->composite_cleanup = fu_hpi_cfu_plugin_composite_cleanup;
 }
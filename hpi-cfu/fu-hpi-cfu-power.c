@@ -0,0 +1,209 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-hpi-cfu-power.h"
+
+/*
+ * Keeps the dock and every hub between it and the host at full power, as with runtime PM
+ * the link drops into a low-power state in the gaps between bursts and every transfer
+ * then pays the wake-up latency. The previous values are put back afterwards.
+ */
+struct _FuHpiCfuPower {
+	GObject parent_instance;
+	FuUdevDevice *device;
+	GPtrArray *saved; /* element-type FuHpiCfuPowerAttr */
+};
+
+typedef struct {
+	FuUdevDevice *device;
+	const gchar *attr;
+	gchar *value;
+} FuHpiCfuPowerAttr;
+
+G_DEFINE_TYPE(FuHpiCfuPower, fu_hpi_cfu_power, G_TYPE_OBJECT)
+
+/* attribute, full power value */
+static const gchar *fu_hpi_cfu_power_attrs[][2] = {
+    {"power/control", "on"},
+    {"power/usb2_hardware_lpm", "0"},
+};
+
+static void
+fu_hpi_cfu_power_attr_free(FuHpiCfuPowerAttr *attr)
+{
+	g_object_unref(attr->device);
+	g_free(attr->value);
+	g_free(attr);
+}
+
+/* LPM reads back as enabled or disabled, but only a boolean can be written */
+static gchar *
+fu_hpi_cfu_power_read(FuUdevDevice *device, const gchar *attr, GError **error)
+{
+	g_autofree gchar *value =
+	    fu_udev_device_read_sysfs(device, attr, FU_UDEV_DEVICE_ATTR_READ_TIMEOUT_DEFAULT, error);
+	if (value == NULL)
+		return NULL;
+	if (g_strcmp0(attr, "power/usb2_hardware_lpm") == 0) {
+		if (g_strcmp0(value, "enabled") == 0)
+			return g_strdup("1");
+		if (g_strcmp0(value, "disabled") == 0)
+			return g_strdup("0");
+	}
+	return g_steal_pointer(&value);
+}
+
+static void
+fu_hpi_cfu_power_pin_device(FuHpiCfuPower *self, FuUdevDevice *device)
+{
+	/* emulated */
+	if (fu_udev_device_get_sysfs_path(device) == NULL)
+		return;
+	for (guint i = 0; i < G_N_ELEMENTS(fu_hpi_cfu_power_attrs); i++) {
+		FuHpiCfuPowerAttr *attr;
+		const gchar *attr_name = fu_hpi_cfu_power_attrs[i][0];
+		g_autofree gchar *value = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		/* not every hub has LPM */
+		value = fu_hpi_cfu_power_read(device, attr_name, NULL);
+		if (value == NULL)
+			continue;
+		if (g_strcmp0(value, fu_hpi_cfu_power_attrs[i][1]) == 0)
+			continue;
+		if (!fu_udev_device_write_sysfs(device,
+						attr_name,
+						fu_hpi_cfu_power_attrs[i][1],
+						FU_UDEV_DEVICE_ATTR_READ_TIMEOUT_DEFAULT,
+						&error_local)) {
+			g_debug("ignoring: %s", error_local->message);
+			continue;
+		}
+		g_debug("pinned %s/%s, was %s",
+			fu_udev_device_get_sysfs_path(device),
+			attr_name,
+			value);
+		attr = g_new0(FuHpiCfuPowerAttr, 1);
+		attr->device = g_object_ref(device);
+		attr->attr = attr_name;
+		attr->value = g_steal_pointer(&value);
+		g_ptr_array_add(self->saved, attr);
+	}
+}
+
+/**
+ * fu_hpi_cfu_power_pin:
+ * @self: a #FuHpiCfuPower
+ * @error: (nullable): optional return location for an error
+ *
+ * Disables runtime suspend and LPM on the device and its upstream hubs, up to and
+ * including the root hub. Attributes that are missing or not writable are skipped.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+fu_hpi_cfu_power_pin(FuHpiCfuPower *self, GError **error)
+{
+	g_autoptr(FuDevice) device = NULL;
+
+	g_return_val_if_fail(FU_IS_HPI_CFU_POWER(self), FALSE);
+
+	/* the hubs are the USB device parents */
+	device = g_object_ref(FU_DEVICE(self->device));
+	while (device != NULL) {
+		FuDevice *parent;
+
+		fu_hpi_cfu_power_pin_device(self, FU_UDEV_DEVICE(device));
+		parent = fu_device_get_backend_parent_with_subsystem(device, "usb:usb_device", NULL);
+		g_object_unref(device);
+		device = parent;
+	}
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_power_restore:
+ * @self: a #FuHpiCfuPower
+ * @error: (nullable): optional return location for an error
+ *
+ * Puts back the values changed by fu_hpi_cfu_power_pin(), in the reverse order. The
+ * device may already have gone away for the reboot, which is not an error.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+fu_hpi_cfu_power_restore(FuHpiCfuPower *self, GError **error)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_POWER(self), FALSE);
+
+	for (guint i = self->saved->len; i > 0; i--) {
+		FuHpiCfuPowerAttr *attr = g_ptr_array_index(self->saved, i - 1);
+		const gchar *sysfs_path = fu_udev_device_get_sysfs_path(attr->device);
+		g_autoptr(GError) error_local = NULL;
+
+		if (fu_udev_device_write_sysfs(attr->device,
+					       attr->attr,
+					       attr->value,
+					       FU_UDEV_DEVICE_ATTR_READ_TIMEOUT_DEFAULT,
+					       &error_local))
+			continue;
+		if (!g_file_test(sysfs_path, G_FILE_TEST_EXISTS)) {
+			g_debug("not restoring %s/%s, device has gone away", sysfs_path, attr->attr);
+			continue;
+		}
+		g_warning("failed to restore %s/%s to %s: %s",
+			  sysfs_path,
+			  attr->attr,
+			  attr->value,
+			  error_local->message);
+	}
+	g_ptr_array_set_size(self->saved, 0);
+
+	/* success */
+	return TRUE;
+}
+
+/**
+ * fu_hpi_cfu_power_new:
+ * @device: the USB device
+ *
+ * Returns: (transfer full): a #FuHpiCfuPower
+ **/
+FuHpiCfuPower *
+fu_hpi_cfu_power_new(FuUdevDevice *device)
+{
+	FuHpiCfuPower *self = g_object_new(FU_TYPE_HPI_CFU_POWER, NULL);
+	self->device = g_object_ref(device);
+	return self;
+}
+
+static void
+fu_hpi_cfu_power_init(FuHpiCfuPower *self)
+{
+	self->saved = g_ptr_array_new_with_free_func((GDestroyNotify)fu_hpi_cfu_power_attr_free);
+}
+
+static void
+fu_hpi_cfu_power_finalize(GObject *object)
+{
+	FuHpiCfuPower *self = FU_HPI_CFU_POWER(object);
+
+	g_object_unref(self->device);
+	g_ptr_array_unref(self->saved);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_power_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_power_class_init(FuHpiCfuPowerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = fu_hpi_cfu_power_finalize;
+}
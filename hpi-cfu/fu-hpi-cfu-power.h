@@ -0,0 +1,19 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#define FU_TYPE_HPI_CFU_POWER (fu_hpi_cfu_power_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuPower, fu_hpi_cfu_power, FU, HPI_CFU_POWER, GObject)
+
+FuHpiCfuPower *
+fu_hpi_cfu_power_new(FuUdevDevice *device);
+gboolean
+fu_hpi_cfu_power_pin(FuHpiCfuPower *self, GError **error);
+gboolean
+fu_hpi_cfu_power_restore(FuHpiCfuPower *self, GError **error);
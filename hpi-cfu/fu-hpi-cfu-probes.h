@@ -0,0 +1,27 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+/*
+ * USDT probes for tracing updates with bpftrace or perf, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/libexec/fwupd/fwupd:hpi_cfu:report_submit { @[arg2] = count(); }'
+ *
+ * Each probe is a single nop until a tracer attaches to it.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define FU_HPI_CFU_PROBE2(name, a1, a2)	    DTRACE_PROBE2(hpi_cfu, name, a1, a2)
+#define FU_HPI_CFU_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(hpi_cfu, name, a1, a2, a3)
+#else
+#define FU_HPI_CFU_PROBE2(name, a1, a2)                                                            \
+	do {                                                                                       \
+	} while (0)
+#define FU_HPI_CFU_PROBE3(name, a1, a2, a3)                                                        \
+	do {                                                                                       \
+	} while (0)
+#endif
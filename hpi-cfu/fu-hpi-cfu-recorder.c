@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-hpi-cfu-recorder.h"
+
+/*
+ * A fixed-size ring of the most recent events of an update, cheap enough to leave on for
+ * every transfer and only turned into text when the update fails.
+ */
+typedef struct {
+	gint64 timestamp; /* µs since the reset */
+	guint32 address;
+	gint32 seq;    /* or -1 if the report has none */
+	gint16 status; /* ack status or reject reason, or -1 if there is none */
+	guint8 kind;   /* FuHpiCfuRecorderKind */
+	guint8 value;  /* report ID, state or offer reply, depending on the kind */
+	guint8 length;
+} FuHpiCfuRecorderEntry;
+
+struct _FuHpiCfuRecorder {
+	GObject parent_instance;
+	FuHpiCfuRecorderEntry *entries;
+	guint size;
+	guint64 count; /* total added, the oldest are overwritten */
+	gint64 start_time;
+};
+
+G_DEFINE_TYPE(FuHpiCfuRecorder, fu_hpi_cfu_recorder, G_TYPE_OBJECT)
+
+void
+fu_hpi_cfu_recorder_reset(FuHpiCfuRecorder *self)
+{
+	g_return_if_fail(FU_IS_HPI_CFU_RECORDER(self));
+	self->count = 0;
+	self->start_time = g_get_monotonic_time();
+}
+
+void
+fu_hpi_cfu_recorder_add(FuHpiCfuRecorder *self,
+			FuHpiCfuRecorderKind kind,
+			guint8 value,
+			gint32 status,
+			gint32 seq,
+			guint32 address,
+			guint8 length)
+{
+	FuHpiCfuRecorderEntry *entry = &self->entries[self->count++ % self->size];
+	entry->timestamp = g_get_monotonic_time() - self->start_time;
+	entry->kind = kind;
+	entry->value = value;
+	entry->status = status >= 0 ? (gint16)(status & G_MAXUINT8) : -1;
+	entry->seq = seq >= 0 ? (gint32)(seq & G_MAXUINT16) : -1;
+	entry->address = address;
+	entry->length = length;
+}
+
+static void
+fu_hpi_cfu_recorder_entry_to_string(FuHpiCfuRecorderEntry *entry, GString *str)
+{
+	g_string_append_printf(str,
+			       "%10.3fms %-6s ",
+			       (gdouble)entry->timestamp / 1000.f,
+			       fu_hpi_cfu_recorder_kind_to_string(entry->kind));
+	switch (entry->kind) {
+	case FU_HPI_CFU_RECORDER_KIND_SUBMIT:
+		g_string_append_printf(str,
+				       "seq:0x%04x address:0x%08x length:%u\n",
+				       (guint)entry->seq,
+				       entry->address,
+				       entry->length);
+		break;
+	case FU_HPI_CFU_RECORDER_KIND_ACK:
+		if (entry->seq >= 0)
+			g_string_append_printf(str, "seq:0x%04x ", (guint)entry->seq);
+		g_string_append_printf(str,
+				       "report-id:0x%02x status:0x%02x\n",
+				       entry->value,
+				       (guint)entry->status);
+		break;
+	case FU_HPI_CFU_RECORDER_KIND_STATE:
+		g_string_append_printf(str, "%s\n", fu_hpi_cfu_state_to_string(entry->value));
+		break;
+	case FU_HPI_CFU_RECORDER_KIND_OFFER:
+		g_string_append_printf(str,
+				       "%s ",
+				       fu_hpi_cfu_firmware_update_offer_to_string(entry->value));
+		if (entry->status >= 0)
+			g_string_append_printf(str, "reason:0x%02x\n", (guint)entry->status);
+		else
+			g_string_append(str, "reason:none\n");
+		break;
+	default:
+		g_string_append_printf(str, "0x%02x\n", entry->value);
+		break;
+	}
+}
+
+/**
+ * fu_hpi_cfu_recorder_to_string:
+ * @self: a #FuHpiCfuRecorder
+ *
+ * Formats the retained events, oldest first.
+ *
+ * Returns: (transfer full): a string
+ **/
+gchar *
+fu_hpi_cfu_recorder_to_string(FuHpiCfuRecorder *self)
+{
+	GString *str = g_string_new(NULL);
+	guint64 first = self->count > self->size ? self->count - self->size : 0;
+
+	g_return_val_if_fail(FU_IS_HPI_CFU_RECORDER(self), NULL);
+
+	if (first > 0)
+		g_string_append_printf(str, "(%" G_GUINT64_FORMAT " older events dropped)\n", first);
+	for (guint64 i = first; i < self->count; i++)
+		fu_hpi_cfu_recorder_entry_to_string(&self->entries[i % self->size], str);
+	return g_string_free(str, FALSE);
+}
+
+/**
+ * fu_hpi_cfu_recorder_new:
+ * @size: number of events to keep
+ *
+ * Returns: (transfer full): a #FuHpiCfuRecorder
+ **/
+FuHpiCfuRecorder *
+fu_hpi_cfu_recorder_new(guint size)
+{
+	FuHpiCfuRecorder *self;
+	g_return_val_if_fail(size > 0, NULL);
+	self = g_object_new(FU_TYPE_HPI_CFU_RECORDER, NULL);
+	self->size = size;
+	self->entries = g_new0(FuHpiCfuRecorderEntry, size);
+	fu_hpi_cfu_recorder_reset(self);
+	return self;
+}
+
+static void
+fu_hpi_cfu_recorder_init(FuHpiCfuRecorder *self)
+{
+}
+
+static void
+fu_hpi_cfu_recorder_finalize(GObject *object)
+{
+	FuHpiCfuRecorder *self = FU_HPI_CFU_RECORDER(object);
+
+	g_free(self->entries);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_recorder_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_recorder_class_init(FuHpiCfuRecorderClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = fu_hpi_cfu_recorder_finalize;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <fwupdplugin.h>
+
+#include "fu-hpi-cfu-struct.h"
+
+#define FU_TYPE_HPI_CFU_RECORDER (fu_hpi_cfu_recorder_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuRecorder, fu_hpi_cfu_recorder, FU, HPI_CFU_RECORDER, GObject)
+
+FuHpiCfuRecorder *
+fu_hpi_cfu_recorder_new(guint size);
+void
+fu_hpi_cfu_recorder_reset(FuHpiCfuRecorder *self);
+void
+fu_hpi_cfu_recorder_add(FuHpiCfuRecorder *self,
+			FuHpiCfuRecorderKind kind,
+			guint8 value,
+			gint32 status,
+			gint32 seq,
+			guint32 address,
+			guint8 length);
+gchar *
+fu_hpi_cfu_recorder_to_string(FuHpiCfuRecorder *self);
@@ -0,0 +1,299 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include "fu-cfu-struct.h"
+#include "fu-hpi-cfu-common.h"
+#include "fu-hpi-cfu-sim-device.h"
+#include "fu-hpi-cfu-struct.h"
+
+/*
+ * A stand-in dock for the self tests and benchmarks, which answers the version report, the
+ * handshake, the content reports, the swap-pending check and the activate command the way a
+ * real dock does, after an optional delay on every transfer.
+ */
+struct _FuHpiCfuSimDevice {
+	FuHpiCfuDevice parent_instance;
+	guint8 bulk_acksize;
+	guint ack_window;
+	guint latency;	 /* µs, added to every transfer */
+	gboolean staged; /* all the content has been received */
+	guint resets;	 /* into the staged image */
+	GQueue *replies; /* element-type GByteArray */
+};
+
+G_DEFINE_TYPE(FuHpiCfuSimDevice, fu_hpi_cfu_sim_device, FU_TYPE_HPI_CFU_DEVICE)
+
+#define FU_HPI_CFU_SIM_DEVICE_VERSION 0x01020304
+
+static void
+fu_hpi_cfu_sim_device_add_reply(FuHpiCfuSimDevice *self, guint8 status, guint8 reason)
+{
+	GByteArray *buf = g_byte_array_new();
+	fu_byte_array_set_size(buf, 16, 0x0);
+	buf->data[0] = OFFER_REPORT_ID;
+	buf->data[9] = reason;
+	buf->data[13] = status;
+	g_queue_push_tail(self->replies, buf);
+}
+
+static void
+fu_hpi_cfu_sim_device_add_ack(FuHpiCfuSimDevice *self, guint16 seq)
+{
+	GByteArray *buf = g_byte_array_new();
+	fu_byte_array_set_size(buf, 16, 0x0);
+	buf->data[0] = CONTENT_ACK_REPORT_ID;
+	fu_memwrite_uint16(buf->data + 1, seq, G_LITTLE_ENDIAN);
+	buf->data[5] = FU_HPI_FIRMWARE_UPDATE_STATUS_SUCCESS;
+	g_queue_push_tail(self->replies, buf);
+}
+
+static gboolean
+fu_hpi_cfu_sim_device_offer(FuHpiCfuSimDevice *self, const guint8 *buf, gsize bufsz, GError **error)
+{
+	if (bufsz < 4) {
+		g_set_error_literal(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_DATA, "offer too small");
+		return FALSE;
+	}
+
+	/* start-entire-transaction, start-offer-list or end-offer-list */
+	if (buf[3] == 0xFF) {
+		fu_hpi_cfu_sim_device_add_reply(self, FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT, 0);
+		return TRUE;
+	}
+
+	/* only a staged image can be activated */
+	if (buf[3] == 0xFE) {
+		if (buf[1] != FU_HPI_CFU_OFFER_COMMAND_ACTIVATE_STAGED || !self->staged) {
+			fu_hpi_cfu_sim_device_add_reply(self,
+							FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT,
+							FU_HPI_CFU_FIRMWARE_OFFER_REJECT_INV_COMPONENT);
+			return TRUE;
+		}
+		self->staged = FALSE;
+		self->resets++;
+		fu_hpi_cfu_sim_device_add_reply(self, FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT, 0);
+		return TRUE;
+	}
+
+	/* any offer while an image is staged */
+	if (self->staged) {
+		fu_hpi_cfu_sim_device_add_reply(self,
+						FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT,
+						FU_HPI_CFU_FIRMWARE_OFFER_REJECT_SWAP_PENDING);
+		return TRUE;
+	}
+	fu_hpi_cfu_sim_device_add_reply(self, FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT, 0);
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_sim_device_content(FuHpiCfuSimDevice *self,
+			      const guint8 *buf,
+			      gsize bufsz,
+			      GError **error)
+{
+	guint8 flags = 0;
+	guint16 seq = 0;
+
+	if (!fu_memread_uint8_safe(buf, bufsz, 0x1, &flags, error))
+		return FALSE;
+	if (!fu_memread_uint16_safe(buf, bufsz, 0x3, &seq, G_LITTLE_ENDIAN, error))
+		return FALSE;
+	if (flags & FU_CFU_CONTENT_FLAG_LAST_BLOCK) {
+		self->staged = TRUE;
+		fu_hpi_cfu_sim_device_add_ack(self, seq);
+		return TRUE;
+	}
+	if (seq % self->ack_window == 0)
+		fu_hpi_cfu_sim_device_add_ack(self, seq);
+	return TRUE;
+}
+
+static gboolean
+fu_hpi_cfu_sim_device_control_transfer(FuHpiCfuDevice *device,
+				       FuUsbDirection direction,
+				       guint8 request,
+				       guint16 value,
+				       guint16 idx,
+				       guint8 *data,
+				       gsize length,
+				       gsize *actual_length,
+				       guint timeout,
+				       GCancellable *cancellable,
+				       GError **error)
+{
+	FuHpiCfuSimDevice *self = FU_HPI_CFU_SIM_DEVICE(device);
+
+	if (self->latency > 0)
+		g_usleep(self->latency);
+
+	/* the version report */
+	if (direction == FU_USB_DIRECTION_DEVICE_TO_HOST) {
+		memset(data, 0x0, length);
+		if (!fu_memwrite_uint32_safe(data,
+					     length,
+					     0x5,
+					     FU_HPI_CFU_SIM_DEVICE_VERSION,
+					     G_LITTLE_ENDIAN,
+					     error))
+			return FALSE;
+		if (!fu_memwrite_uint8_safe(data, length, 0x9, self->bulk_acksize, error))
+			return FALSE;
+		if (!fu_memwrite_uint8_safe(data, length, 0xA, 0x01, error))
+			return FALSE;
+		if (actual_length != NULL)
+			*actual_length = MIN(length, 60);
+		return TRUE;
+	}
+
+	/* the offer is sent with the content report ID, so go by the report in the buffer */
+	if (length > 0 && data[0] == OFFER_REPORT_ID)
+		return fu_hpi_cfu_sim_device_offer(self, data, length, error);
+	if (length > 0 && data[0] == FIRMWARE_REPORT_ID)
+		return fu_hpi_cfu_sim_device_content(self, data, length, error);
+	g_set_error(error,
+		    FWUPD_ERROR,
+		    FWUPD_ERROR_NOT_SUPPORTED,
+		    "report 0x%04x not supported",
+		    value);
+	return FALSE;
+}
+
+static gboolean
+fu_hpi_cfu_sim_device_interrupt_transfer(FuHpiCfuDevice *device,
+					 guint8 endpoint,
+					 guint8 *data,
+					 gsize length,
+					 gsize *actual_length,
+					 guint timeout,
+					 GCancellable *cancellable,
+					 GError **error)
+{
+	FuHpiCfuSimDevice *self = FU_HPI_CFU_SIM_DEVICE(device);
+	g_autoptr(GByteArray) buf = g_queue_pop_head(self->replies);
+
+	if (self->latency > 0)
+		g_usleep(self->latency);
+
+	/* nothing queued, so wait out the timeout like a real dock would */
+	if (buf == NULL) {
+		g_usleep((gulong)timeout * 1000);
+		g_set_error_literal(error, FWUPD_ERROR, FWUPD_ERROR_TIMED_OUT, "no reply");
+		return FALSE;
+	}
+	memset(data, 0x0, length);
+	if (!fu_memcpy_safe(data, length, 0x0, buf->data, buf->len, 0x0, buf->len, error))
+		return FALSE;
+	if (actual_length != NULL)
+		*actual_length = buf->len;
+	return TRUE;
+}
+
+void
+fu_hpi_cfu_sim_device_set_bulk_acksize(FuHpiCfuSimDevice *self, guint8 bulk_acksize)
+{
+	g_return_if_fail(FU_IS_HPI_CFU_SIM_DEVICE(self));
+	self->bulk_acksize = bulk_acksize;
+	self->ack_window = bulk_acksize == 0 ? 1 : 8 << bulk_acksize;
+}
+
+void
+fu_hpi_cfu_sim_device_set_latency(FuHpiCfuSimDevice *self, guint latency)
+{
+	g_return_if_fail(FU_IS_HPI_CFU_SIM_DEVICE(self));
+	self->latency = latency;
+}
+
+gboolean
+fu_hpi_cfu_sim_device_get_staged(FuHpiCfuSimDevice *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_SIM_DEVICE(self), FALSE);
+	return self->staged;
+}
+
+guint
+fu_hpi_cfu_sim_device_get_resets(FuHpiCfuSimDevice *self)
+{
+	g_return_val_if_fail(FU_IS_HPI_CFU_SIM_DEVICE(self), 0);
+	return self->resets;
+}
+
+/* an archive with one contiguous payload, so every report is full */
+GBytes *
+fu_hpi_cfu_sim_device_build_archive(gsize size, GError **error)
+{
+	g_autoptr(FuFirmware) archive = fu_archive_firmware_new();
+	g_autoptr(FuFirmware) img_offer = NULL;
+	g_autoptr(FuFirmware) img_payload = NULL;
+	g_autoptr(GByteArray) offer = g_byte_array_new();
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GBytes) blob_offer = NULL;
+	g_autoptr(GBytes) blob_payload = NULL;
+
+	/* segment_number, flags, component_id, token, variant, minor_version, major_version */
+	fu_byte_array_set_size(offer, FU_STRUCT_HPI_CFU_OFFER_SIZE, 0x0);
+	offer->data[2] = 0x01;
+	offer->data[3] = 0x01;
+	offer->data[7] = 0x02;
+	blob_offer = g_bytes_new(offer->data, offer->len);
+
+	for (gsize i = 0; i < size; i += G_MAXUINT8) {
+		guint8 len = MIN(size - i, G_MAXUINT8);
+		fu_byte_array_append_uint32(payload, i, G_LITTLE_ENDIAN);
+		fu_byte_array_append_uint8(payload, len);
+		for (guint j = 0; j < len; j++)
+			fu_byte_array_append_uint8(payload, (i + j) & 0xFF);
+	}
+	blob_payload = g_bytes_new(payload->data, payload->len);
+
+	fu_archive_firmware_set_format(FU_ARCHIVE_FIRMWARE(archive), FU_ARCHIVE_FORMAT_ZIP);
+	fu_archive_firmware_set_compression(FU_ARCHIVE_FIRMWARE(archive),
+					    FU_ARCHIVE_COMPRESSION_NONE);
+	img_offer = fu_firmware_new_from_bytes(blob_offer);
+	fu_firmware_set_id(img_offer, "sim.offer.bin");
+	fu_firmware_add_image(archive, img_offer);
+	img_payload = fu_firmware_new_from_bytes(blob_payload);
+	fu_firmware_set_id(img_payload, "sim.payload.bin");
+	fu_firmware_add_image(archive, img_payload);
+	return fu_firmware_write(archive, error);
+}
+
+static void
+fu_hpi_cfu_sim_device_init(FuHpiCfuSimDevice *self)
+{
+	self->ack_window = 1;
+	self->replies = g_queue_new();
+	fu_device_set_id(FU_DEVICE(self), "hpi-cfu-sim");
+}
+
+static void
+fu_hpi_cfu_sim_device_finalize(GObject *object)
+{
+	FuHpiCfuSimDevice *self = FU_HPI_CFU_SIM_DEVICE(object);
+
+	g_queue_free_full(self->replies, (GDestroyNotify)g_byte_array_unref);
+
+	G_OBJECT_CLASS(fu_hpi_cfu_sim_device_parent_class)->finalize(object);
+}
+
+static void
+fu_hpi_cfu_sim_device_class_init(FuHpiCfuSimDeviceClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	FuHpiCfuDeviceClass *hpi_cfu_class = FU_HPI_CFU_DEVICE_CLASS(klass);
+
+	object_class->finalize = fu_hpi_cfu_sim_device_finalize;
+	hpi_cfu_class->control_transfer = fu_hpi_cfu_sim_device_control_transfer;
+	hpi_cfu_class->interrupt_transfer = fu_hpi_cfu_sim_device_interrupt_transfer;
+}
+
+FuHpiCfuSimDevice *
+fu_hpi_cfu_sim_device_new(FuContext *ctx)
+{
+	return g_object_new(FU_TYPE_HPI_CFU_SIM_DEVICE, "context", ctx, NULL);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include "fu-hpi-cfu-device.h"
+
+#define FU_TYPE_HPI_CFU_SIM_DEVICE (fu_hpi_cfu_sim_device_get_type())
+G_DECLARE_FINAL_TYPE(FuHpiCfuSimDevice,
+		     fu_hpi_cfu_sim_device,
+		     FU,
+		     HPI_CFU_SIM_DEVICE,
+		     FuHpiCfuDevice)
+
+FuHpiCfuSimDevice *
+fu_hpi_cfu_sim_device_new(FuContext *ctx);
+void
+fu_hpi_cfu_sim_device_set_bulk_acksize(FuHpiCfuSimDevice *self, guint8 bulk_acksize);
+void
+fu_hpi_cfu_sim_device_set_latency(FuHpiCfuSimDevice *self, guint latency);
+gboolean
+fu_hpi_cfu_sim_device_get_staged(FuHpiCfuSimDevice *self);
+guint
+fu_hpi_cfu_sim_device_get_resets(FuHpiCfuSimDevice *self);
+GBytes *
+fu_hpi_cfu_sim_device_build_archive(gsize size, GError **error);
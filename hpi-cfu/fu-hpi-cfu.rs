@@ -32,6 +32,7 @@ enum FuHpiCfuState {
     VerifyCheckSwapPendingSendUpdateEndOfferList = 0x15,
     VerifyCheckSwapPendingUpdateEndOfferListAccepted = 0x16,
     UpdateVerifyError = 0x17,
+    PipelinedHandshake = 0x18,
 }
 
 #[derive(ToString)]
@@ -48,6 +49,14 @@ enum FuHpiCfuFirmwareOfferReject {
     Variant = 0x08,
 }
 
+// command code of the offer to the command component
+#[derive(ToString)]
+#[repr(u8)]
+enum FuHpiCfuOfferCommand {
+    NotifyOnReady = 0x01,
+    ActivateStaged = 0x02,
+}
+
 #[derive(ToString)]
 #[repr(u8)]
 enum FuHpiCfuFirmwareUpdateOffer {
@@ -60,6 +69,14 @@ enum FuHpiCfuFirmwareUpdateOffer {
 }
 
 
+// bits of the offer flags byte
+#[repr(u8)]
+enum FuHpiCfuOfferFlag {
+    None = 0x00,
+    ForceImmediateReset = 0x40,
+    ForceIgnoreVersion = 0x80,
+}
+
 #[derive(ToString)]
 #[repr(u8)]
 enum FuHpiCfuInfo {
@@ -88,7 +105,7 @@ enum FuHpiFirmwareUpdateStatus {
 
 #[derive(New, Getters)]
 struct FuStructHpiCfuOfferCmd {
-    report_id: u8,
+    report_id: u8 == 0x25,
     segment_number: u8,
     flags: u8,
     component_id: u8,
@@ -112,3 +129,108 @@ struct FuStructHpiCfuPayloadCmd {
     address: u32le,
     data: [u8; 52],
 }
+
+#[derive(Getters, ParseStream)]
+struct FuStructHpiCfuOffer {
+    segment_number: u8,
+    flags: u8,
+    component_id: u8,
+    token: u8,
+    variant: u8,
+    minor_version: u16le,
+    major_version: u8,
+    vendor_specific: u32le,
+    protocol_version: u8,
+    _reserved0: u8,
+    product_specific: u16le,
+}
+
+#[derive(Getters, ParseStream)]
+struct FuStructHpiCfuPayloadRecord {
+    address: u32le,
+    length: u8,
+}
+
+// header of the optional pre-packetized `*.reports.bin`, followed by the reports as sent
+#[derive(Getters, Parse)]
+struct FuStructHpiCfuReportsHdr {
+    magic: [char; 4] == "HPCR",
+    version: u16le == 1,
+    report_size: u16le,
+    count: u32le,
+    payload_size: u32le,
+    crc32: u32le, // of all the reports
+}
+
+// pcapng blocks used by the optional session capture
+#[derive(New)]
+struct FuStructHpiCfuPcapngSectionHdr {
+    block_type: u32le == 0x0A0D0D0A,
+    block_length: u32le == 28,
+    byte_order_magic: u32le == 0x1A2B3C4D,
+    version_major: u16le == 1,
+    version_minor: u16le == 0,
+    section_length: u64le == 0xFFFFFFFFFFFFFFFF,
+    block_length_end: u32le == 28,
+}
+
+#[derive(New)]
+struct FuStructHpiCfuPcapngInterfaceDesc {
+    block_type: u32le == 0x00000001,
+    block_length: u32le == 20,
+    link_type: u16le == 220, // LINKTYPE_USB_LINUX_MMAPPED
+    _reserved: u16le,
+    snap_len: u32le,
+    block_length_end: u32le == 20,
+}
+
+#[derive(New)]
+struct FuStructHpiCfuPcapngPacketHdr {
+    block_type: u32le == 0x00000006,
+    block_length: u32le,
+    interface_id: u32le,
+    timestamp_high: u32le,
+    timestamp_low: u32le,
+    captured_length: u32le,
+    original_length: u32le,
+}
+
+#[repr(u8)]
+enum FuHpiCfuUsbmonXferType {
+    Isochronous = 0x00,
+    Interrupt = 0x01,
+    Control = 0x02,
+    Bulk = 0x03,
+}
+
+// the Linux usbmon mmapped packet header, values in host order
+#[derive(New)]
+struct FuStructHpiCfuUsbmonHdr {
+    id: u64le,
+    event_type: u8,
+    xfer_type: u8,
+    epnum: u8,
+    devnum: u8,
+    busnum: u16le,
+    flag_setup: u8,
+    flag_data: u8,
+    ts_sec: u64le,
+    ts_usec: u32le,
+    status: u32le,
+    length: u32le,
+    len_cap: u32le,
+    setup: [u8; 8],
+    interval: u32le,
+    start_frame: u32le,
+    xfer_flags: u32le,
+    ndesc: u32le,
+}
+
+#[derive(ToString)]
+#[repr(u8)]
+enum FuHpiCfuRecorderKind {
+    Submit = 0x00,
+    Ack = 0x01,
+    State = 0x02,
+    Offer = 0x03,
+}
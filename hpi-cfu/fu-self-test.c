@@ -0,0 +1,801 @@
+/*
+ * Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "config.h"
+
+#include <fwupdplugin.h>
+
+#include "fu-cfu-struct.h"
+#include "fu-hpi-cfu-image.h"
+#include "fu-hpi-cfu-manifest.h"
+#include "fu-hpi-cfu-offer.h"
+#include "fu-hpi-cfu-payload.h"
+#include "fu-hpi-cfu-recorder.h"
+#include "fu-hpi-cfu-sim-device.h"
+#include "fu-hpi-cfu-struct.h"
+
+static void
+fu_hpi_cfu_offer_flags_func(void)
+{
+	struct {
+		FwupdInstallFlags install_flags;
+		gboolean force_version;
+		gboolean force_reset;
+		gboolean deferred;
+		guint8 flags;
+	} map[] = {
+	    {FWUPD_INSTALL_FLAG_NONE, FALSE, FALSE, FALSE, 0x00},
+	    {FWUPD_INSTALL_FLAG_NONE, TRUE, FALSE, FALSE, 0x80},
+	    {FWUPD_INSTALL_FLAG_NONE, FALSE, TRUE, FALSE, 0x40},
+	    {FWUPD_INSTALL_FLAG_NONE, TRUE, TRUE, FALSE, 0xC0},
+	    {FWUPD_INSTALL_FLAG_NONE, FALSE, FALSE, TRUE, 0x00},
+	    {FWUPD_INSTALL_FLAG_NONE, TRUE, FALSE, TRUE, 0x80},
+	    {FWUPD_INSTALL_FLAG_NONE, FALSE, TRUE, TRUE, 0x00},
+	    {FWUPD_INSTALL_FLAG_NONE, TRUE, TRUE, TRUE, 0x80},
+	    {FWUPD_INSTALL_FLAG_FORCE, FALSE, FALSE, FALSE, 0xC0},
+	    {FWUPD_INSTALL_FLAG_FORCE, TRUE, FALSE, FALSE, 0xC0},
+	    {FWUPD_INSTALL_FLAG_FORCE, FALSE, TRUE, FALSE, 0xC0},
+	    {FWUPD_INSTALL_FLAG_FORCE, TRUE, TRUE, FALSE, 0xC0},
+	    {FWUPD_INSTALL_FLAG_FORCE, FALSE, FALSE, TRUE, 0x80},
+	    {FWUPD_INSTALL_FLAG_FORCE, TRUE, FALSE, TRUE, 0x80},
+	    {FWUPD_INSTALL_FLAG_FORCE, FALSE, TRUE, TRUE, 0x80},
+	    {FWUPD_INSTALL_FLAG_FORCE, TRUE, TRUE, TRUE, 0x80},
+	};
+	/* segment_number, flags, component_id, token, ... */
+	const guint8 buf[16] = {0x00, 0x00, 0x01, 0x02};
+	const guint8 buf_preset[16] = {0x00, 0xC0, 0x01, 0x02};
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GBytes) blob_preset = g_bytes_new_static(buf_preset, sizeof(buf_preset));
+
+	for (guint i = 0; i < G_N_ELEMENTS(map); i++) {
+		guint8 flags = fu_hpi_cfu_offer_flags_for_install(map[i].install_flags,
+								  map[i].force_version,
+								  map[i].force_reset,
+								  map[i].deferred);
+		g_autoptr(GByteArray) st = NULL;
+		g_autoptr(GError) error = NULL;
+
+		g_debug("install flags 0x%x, force-version %i, force-reset %i, deferred %i",
+			(guint)map[i].install_flags,
+			map[i].force_version,
+			map[i].force_reset,
+			map[i].deferred);
+		st = fu_hpi_cfu_offer_build_cmd(blob, flags, &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(st);
+		g_assert_cmpint(st->len, ==, FU_STRUCT_HPI_CFU_OFFER_CMD_SIZE);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_report_id(st), ==, 0x25);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_flags(st), ==, map[i].flags);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_component_id(st), ==, 0x01);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_token(st), ==, 0x02);
+		g_clear_pointer(&st, g_byte_array_unref);
+
+		/* the force bits already in the offer are ignored */
+		st = fu_hpi_cfu_offer_build_cmd(blob_preset, flags, &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(st);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_flags(st), ==, map[i].flags);
+		g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_component_id(st), ==, 0x01);
+	}
+}
+
+static void
+fu_hpi_cfu_offer_flags_activate_func(void)
+{
+	const guint8 buf[16] = {0x00, FU_HPI_CFU_OFFER_FLAG_FORCE_IGNORE_VERSION, 0x01};
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GByteArray) st = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* the saved ignore-version bit only counts once read back into the flags */
+	st = fu_hpi_cfu_offer_build_cmd(blob, FU_HPI_CFU_OFFER_FLAG_NONE, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(st);
+	g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_flags(st), ==, 0x00);
+	g_clear_pointer(&st, g_byte_array_unref);
+	st = fu_hpi_cfu_offer_build_cmd(blob, buf[1] & FU_HPI_CFU_OFFER_FLAG_MASK_FORCE, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(st);
+	g_assert_cmpint(fu_struct_hpi_cfu_offer_cmd_get_flags(st), ==, 0x80);
+}
+
+static void
+fu_hpi_cfu_offer_cmd_short_func(void)
+{
+	const guint8 buf[8] = {0x0};
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GByteArray) st = NULL;
+	g_autoptr(GError) error = NULL;
+
+	st = fu_hpi_cfu_offer_build_cmd(blob, FU_HPI_CFU_OFFER_FLAG_NONE, &error);
+	g_assert_error(error, FWUPD_ERROR, FWUPD_ERROR_READ);
+	g_assert_null(st);
+}
+
+static void
+fu_hpi_cfu_offer_trailing_func(void)
+{
+	gboolean ret;
+	const guint8 buf[20] = {0x00, 0x00, 0x01, 0x02, 0x03, 0x00, 0x04, 0x05};
+	g_autoptr(FuFirmware) offer = fu_hpi_cfu_offer_new();
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GError) error = NULL;
+
+	/* padded by older archive tools, still parsed */
+	ret = fu_firmware_parse_bytes(offer, blob, 0x0, FU_FIRMWARE_PARSE_FLAG_NONE, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(fu_hpi_cfu_offer_get_component_id(FU_HPI_CFU_OFFER(offer)), ==, 0x01);
+	g_assert_cmpstr(fu_firmware_get_version(offer), ==, "05.04.00.03");
+}
+
+static void
+fu_hpi_cfu_offer_short_func(void)
+{
+	gboolean ret;
+	const guint8 buf[12] = {0x0};
+	g_autoptr(FuFirmware) offer = fu_hpi_cfu_offer_new();
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GError) error = NULL;
+
+	ret = fu_firmware_parse_bytes(offer, blob, 0x0, FU_FIRMWARE_PARSE_FLAG_NONE, &error);
+	g_assert_nonnull(error);
+	g_assert_false(ret);
+}
+
+static void
+fu_hpi_cfu_payload_func(void)
+{
+	gboolean ret;
+	/* address, length and data of 2 bytes at 0x1000, then 1 byte at 0x2000 */
+	const guint8 buf[] = {
+	    0x00, 0x10, 0x00, 0x00, 0x02, 0xAA, 0xBB, 0x00, 0x20, 0x00, 0x00, 0x01, 0xCC};
+	g_autoptr(FuFirmware) payload = fu_hpi_cfu_payload_new();
+	g_autoptr(GBytes) blob = g_bytes_new_static(buf, sizeof(buf));
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) chunks = NULL;
+	FuChunk *chk;
+
+	ret = fu_firmware_parse_bytes(payload, blob, 0x0, FU_FIRMWARE_PARSE_FLAG_NONE, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	chunks = fu_firmware_get_chunks(payload, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(chunks);
+	g_assert_cmpint(chunks->len, ==, 2);
+	chk = g_ptr_array_index(chunks, 0);
+	g_assert_cmpint(fu_chunk_get_address(chk), ==, 0x1000);
+	g_assert_cmpint(fu_chunk_get_data_sz(chk), ==, 2);
+	g_assert_cmpint(fu_chunk_get_data(chk)[1], ==, 0xBB);
+	chk = g_ptr_array_index(chunks, 1);
+	g_assert_cmpint(fu_chunk_get_address(chk), ==, 0x2000);
+	g_assert_cmpint(fu_chunk_get_data_sz(chk), ==, 1);
+}
+
+static void
+fu_hpi_cfu_payload_invalid_func(void)
+{
+	struct {
+		const gchar *what;
+		guint8 buf[8];
+		gsize bufsz;
+	} map[] = {
+	    {"zero-length", {0x00, 0x10, 0x00, 0x00, 0x00, 0xAA}, 6},
+	    {"overrun", {0x00, 0x10, 0x00, 0x00, 0x04, 0xAA, 0xBB}, 7},
+	    {"short-header", {0x00, 0x10, 0x00}, 3},
+	    {"empty", {0x0}, 0},
+	};
+
+	for (guint i = 0; i < G_N_ELEMENTS(map); i++) {
+		gboolean ret;
+		g_autoptr(FuFirmware) payload = fu_hpi_cfu_payload_new();
+		g_autoptr(GBytes) blob = g_bytes_new_static(map[i].buf, map[i].bufsz);
+		g_autoptr(GError) error = NULL;
+
+		ret = fu_firmware_parse_bytes(payload,
+					      blob,
+					      0x0,
+					      FU_FIRMWARE_PARSE_FLAG_NONE,
+					      &error);
+		g_assert_nonnull(error);
+		g_debug("%s: %s", map[i].what, error->message);
+		g_assert_false(ret);
+	}
+}
+
+/* a record of @len bytes at @address, each byte the low byte of its own address */
+static void
+fu_hpi_cfu_test_payload_append(GByteArray *payload, guint32 address, guint8 len)
+{
+	fu_byte_array_append_uint32(payload, address, G_LITTLE_ENDIAN);
+	fu_byte_array_append_uint8(payload, len);
+	for (guint i = 0; i < len; i++)
+		fu_byte_array_append_uint8(payload, (address + i) & 0xFF);
+}
+
+static void
+fu_hpi_cfu_test_archive_add(FuFirmware *archive, const gchar *id, const guint8 *buf, gsize bufsz)
+{
+	g_autoptr(GBytes) blob = g_bytes_new(buf, bufsz);
+	g_autoptr(FuFirmware) img = fu_firmware_new_from_bytes(blob);
+	fu_firmware_set_id(img, id);
+	fu_firmware_add_image(archive, img);
+}
+
+/* an archive with a valid offer and @payload */
+static FuFirmware *
+fu_hpi_cfu_test_archive_new(GByteArray *payload)
+{
+	const guint8 offer[16] = {0x00, 0x00, 0x01, 0x02, 0x03, 0x00, 0x04, 0x05};
+	g_autoptr(FuFirmware) archive = fu_archive_firmware_new();
+
+	fu_hpi_cfu_test_archive_add(archive, "test.offer.bin", offer, sizeof(offer));
+	if (payload != NULL)
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.payload.bin",
+					    payload->data,
+					    payload->len);
+	return g_steal_pointer(&archive);
+}
+
+static GPtrArray *
+fu_hpi_cfu_test_packetize(GByteArray *payload, GError **error)
+{
+	g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(payload);
+	g_autoptr(FuHpiCfuImage) image = NULL;
+
+	image = fu_hpi_cfu_image_new_from_archive(archive, NULL, error);
+	if (image == NULL)
+		return NULL;
+	if (!fu_hpi_cfu_image_packetize(image, error))
+		return NULL;
+	return g_ptr_array_ref(fu_hpi_cfu_image_get_reports(image));
+}
+
+static void
+fu_hpi_cfu_image_merge_func(void)
+{
+	GByteArray *st;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = NULL;
+
+	/* records that follow on directly fill whole reports */
+	fu_hpi_cfu_test_payload_append(payload, 0x1000, 10);
+	fu_hpi_cfu_test_payload_append(payload, 0x100A, 60);
+	reports = fu_hpi_cfu_test_packetize(payload, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports);
+	g_assert_cmpint(reports->len, ==, 2);
+	st = g_ptr_array_index(reports, 0);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0x1000);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_length(st), ==, 52);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_seq_number(st), ==, 1);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_data(st, NULL)[10], ==, 0x0A);
+	st = g_ptr_array_index(reports, 1);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0x1034);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_length(st), ==, 18);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_seq_number(st), ==, 2);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_data(st, NULL)[0], ==, 0x34);
+}
+
+static void
+fu_hpi_cfu_image_gap_func(void)
+{
+	GByteArray *st;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = NULL;
+
+	/* every gap starts a new report, and nothing is sent for the gap itself */
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 10);
+	fu_hpi_cfu_test_payload_append(payload, 0x0100, 10);
+	fu_hpi_cfu_test_payload_append(payload, 0x010B, 5);
+	reports = fu_hpi_cfu_test_packetize(payload, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports);
+	g_assert_cmpint(reports->len, ==, 3);
+	st = g_ptr_array_index(reports, 0);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0x0000);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_length(st), ==, 10);
+	st = g_ptr_array_index(reports, 1);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0x0100);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_length(st), ==, 10);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_data(st, NULL)[9], ==, 0x09);
+	st = g_ptr_array_index(reports, 2);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0x010B);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_length(st), ==, 5);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_data(st, NULL)[0], ==, 0x0B);
+}
+
+static void
+fu_hpi_cfu_image_flags_func(void)
+{
+	GByteArray *st;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GByteArray) payload_single = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = NULL;
+	g_autoptr(GPtrArray) reports_single = NULL;
+
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 200);
+	reports = fu_hpi_cfu_test_packetize(payload, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports);
+	g_assert_cmpint(reports->len, ==, 4);
+	for (guint i = 0; i < reports->len; i++) {
+		guint8 flags = 0x0;
+		st = g_ptr_array_index(reports, i);
+		if (i == 0)
+			flags = FU_CFU_CONTENT_FLAG_FIRST_BLOCK;
+		else if (i == reports->len - 1)
+			flags = FU_CFU_CONTENT_FLAG_LAST_BLOCK;
+		g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_report_id(st), ==, 0x20);
+		g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_flags(st), ==, flags);
+	}
+
+	/* one report is both */
+	fu_hpi_cfu_test_payload_append(payload_single, 0x0000, 8);
+	reports_single = fu_hpi_cfu_test_packetize(payload_single, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports_single);
+	g_assert_cmpint(reports_single->len, ==, 1);
+	st = g_ptr_array_index(reports_single, 0);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_flags(st),
+			==,
+			FU_CFU_CONTENT_FLAG_FIRST_BLOCK | FU_CFU_CONTENT_FLAG_LAST_BLOCK);
+}
+
+static void
+fu_hpi_cfu_image_seq_wrap_func(void)
+{
+	GByteArray *st;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = NULL;
+
+	/* exactly 0x10001 full reports, as four fit in every record */
+	for (guint32 i = 0; i < 0x4000; i++)
+		fu_hpi_cfu_test_payload_append(payload, i * 0xD0, 0xD0);
+	fu_hpi_cfu_test_payload_append(payload, 0x4000 * 0xD0, 52);
+	reports = fu_hpi_cfu_test_packetize(payload, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports);
+	g_assert_cmpint(reports->len, ==, 0x10001);
+
+	/* the sequence number wraps, the address does not */
+	st = g_ptr_array_index(reports, 0xFFFE);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_seq_number(st), ==, 0xFFFF);
+	st = g_ptr_array_index(reports, 0xFFFF);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_seq_number(st), ==, 0x0000);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_address(st), ==, 0xFFFF * 52);
+	st = g_ptr_array_index(reports, 0x10000);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_seq_number(st), ==, 0x0001);
+	g_assert_cmpint(fu_struct_hpi_cfu_payload_cmd_get_flags(st),
+			==,
+			FU_CFU_CONTENT_FLAG_LAST_BLOCK);
+}
+
+static void
+fu_hpi_cfu_image_overflow_func(void)
+{
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GByteArray) payload_end = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = NULL;
+	g_autoptr(GPtrArray) reports_end = NULL;
+
+	/* the last byte is at the top of the 32 bit address space */
+	fu_hpi_cfu_test_payload_append(payload_end, 0xFFFFFFE0, 0x20);
+	reports_end = fu_hpi_cfu_test_packetize(payload_end, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(reports_end);
+	g_assert_cmpint(reports_end->len, ==, 1);
+
+	/* one byte past it */
+	fu_hpi_cfu_test_payload_append(payload, 0xFFFFFFE0, 0x21);
+	reports = fu_hpi_cfu_test_packetize(payload, &error);
+	g_assert_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_DATA);
+	g_assert_null(reports);
+}
+
+static void
+fu_hpi_cfu_image_checksum_func(void)
+{
+	const gchar *manifests[] = {
+	    NULL, /* the correct checksum */
+	    "0000000000000000000000000000000000000000000000000000000000000000  test.payload.bin",
+	    "not-a-checksum",
+	    "",
+	};
+	g_autofree gchar *checksum = NULL;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 100);
+	checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, payload->data, payload->len);
+	for (guint i = 0; i < G_N_ELEMENTS(manifests); i++) {
+		const gchar *manifest = manifests[i] != NULL ? manifests[i] : checksum;
+		g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(payload);
+		g_autoptr(FuHpiCfuImage) image = NULL;
+		g_autoptr(GError) error = NULL;
+
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.payload.bin.sha256",
+					    (const guint8 *)manifest,
+					    strlen(manifest));
+		image = fu_hpi_cfu_image_new_from_archive(archive, NULL, &error);
+		if (manifests[i] == NULL) {
+			g_assert_no_error(error);
+			g_assert_nonnull(image);
+			continue;
+		}
+		g_assert_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_FILE);
+		g_assert_null(image);
+	}
+}
+
+/* the reports.bin for @payload, as make-reports.py writes it */
+static GByteArray *
+fu_hpi_cfu_test_reports_new(GByteArray *payload)
+{
+	GByteArray *buf = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) reports = fu_hpi_cfu_test_packetize(payload, &error);
+
+	g_assert_no_error(error);
+	g_assert_nonnull(reports);
+	g_byte_array_append(buf, (const guint8 *)"HPCR", 4);
+	fu_byte_array_append_uint16(buf, 1, G_LITTLE_ENDIAN);
+	fu_byte_array_append_uint16(buf, FU_STRUCT_HPI_CFU_PAYLOAD_CMD_SIZE, G_LITTLE_ENDIAN);
+	fu_byte_array_append_uint32(buf, reports->len, G_LITTLE_ENDIAN);
+	fu_byte_array_append_uint32(buf, payload->len, G_LITTLE_ENDIAN);
+	fu_byte_array_append_uint32(buf, 0x0, G_LITTLE_ENDIAN);
+	for (guint i = 0; i < reports->len; i++) {
+		GByteArray *st = g_ptr_array_index(reports, i);
+		g_byte_array_append(buf, st->data, st->len);
+	}
+	fu_memwrite_uint32(buf->data + 16,
+			   fu_crc32(FU_CRC_KIND_B32_STANDARD, buf->data + 20, buf->len - 20),
+			   G_LITTLE_ENDIAN);
+	return buf;
+}
+
+static FuHpiCfuImage *
+fu_hpi_cfu_test_image_new(GByteArray *payload, GByteArray *reports, GError **error)
+{
+	g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(payload);
+	fu_hpi_cfu_test_archive_add(archive, "test.reports.bin", reports->data, reports->len);
+	return fu_hpi_cfu_image_new_from_archive(archive, NULL, error);
+}
+
+static void
+fu_hpi_cfu_image_reports_func(void)
+{
+	g_autoptr(FuHpiCfuImage) image = NULL;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GByteArray) reports = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* used as-is, the payload is not needed */
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 200);
+	fu_hpi_cfu_test_payload_append(payload, 0x1000, 20);
+	reports = fu_hpi_cfu_test_reports_new(payload);
+	image = fu_hpi_cfu_test_image_new(NULL, reports, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(image);
+	g_assert_true(fu_hpi_cfu_image_is_packetized(image));
+	g_assert_cmpint(fu_hpi_cfu_image_get_reports(image)->len, ==, 5);
+	g_assert_cmpint(fu_hpi_cfu_image_get_payload_size(image), ==, payload->len);
+}
+
+static void
+fu_hpi_cfu_image_reports_invalid_func(void)
+{
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 200);
+	for (guint i = 0; i < 6; i++) {
+		g_autoptr(FuHpiCfuImage) image = NULL;
+		g_autoptr(GByteArray) reports = fu_hpi_cfu_test_reports_new(payload);
+		g_autoptr(GError) error = NULL;
+
+		if (i == 0) {
+			/* magic */
+			reports->data[0] = 'X';
+		} else if (i == 1) {
+			/* report size */
+			fu_memwrite_uint16(reports->data + 6, 60, G_LITTLE_ENDIAN);
+		} else if (i == 2) {
+			/* count */
+			fu_memwrite_uint32(reports->data + 8, 5, G_LITTLE_ENDIAN);
+		} else if (i == 3) {
+			/* count of zero */
+			fu_memwrite_uint32(reports->data + 8, 0, G_LITTLE_ENDIAN);
+			g_byte_array_set_size(reports, 20);
+		} else if (i == 4) {
+			/* truncated */
+			g_byte_array_set_size(reports, reports->len - 1);
+		} else {
+			/* CRC */
+			reports->data[reports->len - 1] ^= 0xFF;
+		}
+		image = fu_hpi_cfu_test_image_new(NULL, reports, &error);
+		g_assert_nonnull(error);
+		g_debug("%s", error->message);
+		g_assert_null(image);
+	}
+}
+
+static void
+fu_hpi_cfu_image_reports_checksum_func(void)
+{
+	g_autofree gchar *checksum = NULL;
+	g_autofree gchar *checksum_other = NULL;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	g_autoptr(GByteArray) payload_other = g_byte_array_new();
+	g_autoptr(GByteArray) reports = NULL;
+
+	fu_hpi_cfu_test_payload_append(payload, 0x0000, 200);
+	fu_hpi_cfu_test_payload_append(payload_other, 0x0000, 199);
+	reports = fu_hpi_cfu_test_reports_new(payload);
+	checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, payload->data, payload->len);
+	checksum_other = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+						     payload_other->data,
+						     payload_other->len);
+
+	/* the payload the reports were built from */
+	{
+		g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(payload);
+		g_autoptr(FuHpiCfuImage) image = NULL;
+		g_autoptr(GError) error = NULL;
+
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.reports.bin",
+					    reports->data,
+					    reports->len);
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.payload.bin.sha256",
+					    (const guint8 *)checksum,
+					    strlen(checksum));
+		image = fu_hpi_cfu_image_new_from_archive(archive, NULL, &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(image);
+		g_assert_true(fu_hpi_cfu_image_is_packetized(image));
+	}
+
+	/* a valid payload, but not the one the reports were built from */
+	{
+		g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(payload_other);
+		g_autoptr(FuHpiCfuImage) image = NULL;
+		g_autoptr(GError) error = NULL;
+
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.reports.bin",
+					    reports->data,
+					    reports->len);
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.payload.bin.sha256",
+					    (const guint8 *)checksum_other,
+					    strlen(checksum_other));
+		image = fu_hpi_cfu_image_new_from_archive(archive, NULL, &error);
+		g_assert_error(error, FWUPD_ERROR, FWUPD_ERROR_INVALID_FILE);
+		g_assert_null(image);
+	}
+
+	/* the manifest cannot be checked without the payload */
+	{
+		g_autoptr(FuFirmware) archive = fu_hpi_cfu_test_archive_new(NULL);
+		g_autoptr(FuHpiCfuImage) image = NULL;
+		g_autoptr(GError) error = NULL;
+
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.reports.bin",
+					    reports->data,
+					    reports->len);
+		fu_hpi_cfu_test_archive_add(archive,
+					    "test.payload.bin.sha256",
+					    (const guint8 *)checksum,
+					    strlen(checksum));
+		image = fu_hpi_cfu_image_new_from_archive(archive, NULL, &error);
+		g_assert_nonnull(error);
+		g_assert_null(image);
+	}
+}
+
+static void
+fu_hpi_cfu_manifest_lookup_func(void)
+{
+	const gchar *alternate_images = NULL;
+	const gchar *images;
+	const gchar *str = "[any]\n"
+			   "Pid=0x03B7\n"
+			   "Images=any\n"
+			   "[rev]\n"
+			   "Pid=0x03B7\n"
+			   "Revision=0x0002\n"
+			   "Images=rev\n"
+			   "[component]\n"
+			   "Pid=0x03B7\n"
+			   "ComponentId=0x01\n"
+			   "Images=component\n"
+			   "[both]\n"
+			   "Pid=0x03B7\n"
+			   "Revision=0x0002\n"
+			   "ComponentId=0x01\n"
+			   "Images=both-bank0\n"
+			   "AlternateImages=both-bank1\n";
+	g_autoptr(FuHpiCfuManifest) manifest = NULL;
+	g_autoptr(GBytes) blob = g_bytes_new_static(str, strlen(str));
+	g_autoptr(GError) error = NULL;
+
+	manifest = fu_hpi_cfu_manifest_new_from_bytes(blob, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(manifest);
+
+	/* most specific first */
+	images = fu_hpi_cfu_manifest_lookup(manifest, 0x03B7, 0x0002, 0x01, &alternate_images);
+	g_assert_cmpstr(images, ==, "both-bank0");
+	g_assert_cmpstr(alternate_images, ==, "both-bank1");
+	images = fu_hpi_cfu_manifest_lookup(manifest, 0x03B7, 0x0002, 0x09, &alternate_images);
+	g_assert_cmpstr(images, ==, "rev");
+	g_assert_null(alternate_images);
+	images = fu_hpi_cfu_manifest_lookup(manifest, 0x03B7, 0x0003, 0x01, &alternate_images);
+	g_assert_cmpstr(images, ==, "component");
+	g_assert_null(alternate_images);
+	images = fu_hpi_cfu_manifest_lookup(manifest, 0x03B7, 0x0003, 0x09, NULL);
+	g_assert_cmpstr(images, ==, "any");
+
+	/* another model */
+	images = fu_hpi_cfu_manifest_lookup(manifest, 0x0BAF, 0x0002, 0x01, NULL);
+	g_assert_null(images);
+}
+
+static void
+fu_hpi_cfu_manifest_invalid_func(void)
+{
+	const gchar *strs[] = {
+	    "",
+	    "[no-pid]\nImages=foo\n",
+	    "[no-images]\nPid=0x0BAF\n",
+	    "[bad-pid]\nPid=0x10000\nImages=foo\n",
+	    "[bad-component]\nPid=0x0BAF\nComponentId=0x100\nImages=foo\n",
+	    "[dup1]\nPid=0x0BAF\nImages=foo\n[dup2]\nPid=0x0BAF\nImages=bar\n",
+	    "not a keyfile",
+	};
+
+	for (guint i = 0; i < G_N_ELEMENTS(strs); i++) {
+		g_autoptr(FuHpiCfuManifest) manifest = NULL;
+		g_autoptr(GBytes) blob = g_bytes_new_static(strs[i], strlen(strs[i]));
+		g_autoptr(GError) error = NULL;
+
+		manifest = fu_hpi_cfu_manifest_new_from_bytes(blob, &error);
+		g_assert_nonnull(error);
+		g_debug("%s", error->message);
+		g_assert_null(manifest);
+	}
+}
+
+static void
+fu_hpi_cfu_recorder_func(void)
+{
+	g_autofree gchar *str = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(FuHpiCfuRecorder) recorder = fu_hpi_cfu_recorder_new(8);
+
+	fu_hpi_cfu_recorder_add(recorder,
+				FU_HPI_CFU_RECORDER_KIND_OFFER,
+				FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_ACCEPT,
+				-1,
+				-1,
+				0,
+				0);
+	fu_hpi_cfu_recorder_add(recorder,
+				FU_HPI_CFU_RECORDER_KIND_OFFER,
+				FU_HPI_CFU_FIRMWARE_UPDATE_OFFER_REJECT,
+				FU_HPI_CFU_FIRMWARE_OFFER_REJECT_SWAP_PENDING,
+				-1,
+				0,
+				0);
+	fu_hpi_cfu_recorder_add(recorder, FU_HPI_CFU_RECORDER_KIND_ACK, 0x22, 0x00, 0x1234, 0, 0);
+	fu_hpi_cfu_recorder_add(recorder, FU_HPI_CFU_RECORDER_KIND_ACK, 0x20, 0x02, -1, 0, 0);
+	str = fu_hpi_cfu_recorder_to_string(recorder);
+	g_debug("%s", str);
+	lines = g_strsplit(str, "\n", -1);
+	g_assert_cmpint(g_strv_length(lines), ==, 5);
+
+	/* an offer that was never rejected has no reason, rather than 0xff */
+	g_assert_true(g_str_has_suffix(lines[0], "accept reason:none"));
+	g_assert_true(g_str_has_suffix(lines[1], "reject reason:0x02"));
+
+	/* only content acks have a sequence number */
+	g_assert_true(g_str_has_suffix(lines[2], "seq:0x1234 report-id:0x22 status:0x00"));
+	g_assert_true(g_str_has_suffix(lines[3], "ack    report-id:0x20 status:0x02"));
+}
+
+static void
+fu_hpi_cfu_device_activate_func(void)
+{
+	gboolean ret;
+	g_autofree gchar *localstatedir = NULL;
+	g_autoptr(FuContext) ctx = fu_context_new();
+	g_autoptr(FuHpiCfuSimDevice) device = fu_hpi_cfu_sim_device_new(ctx);
+	g_autoptr(FuProgress) progress = fu_progress_new(G_STRLOC);
+	g_autoptr(FuProgress) progress_activate = fu_progress_new(G_STRLOC);
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+
+	/* the staged offer is saved here */
+	localstatedir = g_dir_make_tmp("hpi-cfu-XXXXXX", &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(localstatedir);
+	(void)g_setenv("FWUPD_LOCALSTATEDIR_PKG", localstatedir, TRUE);
+
+	/* only stage the image */
+	fu_device_add_private_flag(FU_DEVICE(device), "deferred-activation");
+	ret = fu_hpi_cfu_device_ensure_version(FU_HPI_CFU_DEVICE(device), &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	blob = fu_hpi_cfu_sim_device_build_archive(4096, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob);
+	stream = g_memory_input_stream_new_from_bytes(blob);
+	ret = fu_device_write_firmware(FU_DEVICE(device),
+				       stream,
+				       progress,
+				       FWUPD_INSTALL_FLAG_NONE,
+				       &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_true(fu_device_has_flag(FU_DEVICE(device), FWUPD_DEVICE_FLAG_NEEDS_ACTIVATION));
+	g_assert_false(fu_device_has_flag(FU_DEVICE(device), FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG));
+	g_assert_true(fu_hpi_cfu_sim_device_get_staged(device));
+	g_assert_cmpint(fu_hpi_cfu_sim_device_get_resets(device), ==, 0);
+
+	/* swap-pending is expected, then the command resets the dock */
+	ret = fu_device_activate(FU_DEVICE(device), progress_activate, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_false(fu_hpi_cfu_sim_device_get_staged(device));
+	g_assert_cmpint(fu_hpi_cfu_sim_device_get_resets(device), ==, 1);
+	g_assert_true(fu_device_has_flag(FU_DEVICE(device), FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG));
+
+	/* nothing left to activate */
+	fu_device_remove_flag(FU_DEVICE(device), FWUPD_DEVICE_FLAG_WAIT_FOR_REPLUG);
+	ret = fu_device_activate(FU_DEVICE(device), progress_activate, &error);
+	g_assert_error(error, FWUPD_ERROR, FWUPD_ERROR_NOT_SUPPORTED);
+	g_assert_false(ret);
+	g_assert_cmpint(fu_hpi_cfu_sim_device_get_resets(device), ==, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_log_set_fatal_mask(NULL, G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
+	(void)g_setenv("G_MESSAGES_DEBUG", "all", TRUE);
+	g_test_add_func("/hpi-cfu/offer{flags}", fu_hpi_cfu_offer_flags_func);
+	g_test_add_func("/hpi-cfu/offer{flags-activate}", fu_hpi_cfu_offer_flags_activate_func);
+	g_test_add_func("/hpi-cfu/offer{cmd-short}", fu_hpi_cfu_offer_cmd_short_func);
+	g_test_add_func("/hpi-cfu/offer{trailing}", fu_hpi_cfu_offer_trailing_func);
+	g_test_add_func("/hpi-cfu/offer{short}", fu_hpi_cfu_offer_short_func);
+	g_test_add_func("/hpi-cfu/payload", fu_hpi_cfu_payload_func);
+	g_test_add_func("/hpi-cfu/payload{invalid}", fu_hpi_cfu_payload_invalid_func);
+	g_test_add_func("/hpi-cfu/image{merge}", fu_hpi_cfu_image_merge_func);
+	g_test_add_func("/hpi-cfu/image{gap}", fu_hpi_cfu_image_gap_func);
+	g_test_add_func("/hpi-cfu/image{flags}", fu_hpi_cfu_image_flags_func);
+	g_test_add_func("/hpi-cfu/image{seq-wrap}", fu_hpi_cfu_image_seq_wrap_func);
+	g_test_add_func("/hpi-cfu/image{overflow}", fu_hpi_cfu_image_overflow_func);
+	g_test_add_func("/hpi-cfu/image{checksum}", fu_hpi_cfu_image_checksum_func);
+	g_test_add_func("/hpi-cfu/image{reports}", fu_hpi_cfu_image_reports_func);
+	g_test_add_func("/hpi-cfu/image{reports-invalid}", fu_hpi_cfu_image_reports_invalid_func);
+	g_test_add_func("/hpi-cfu/image{reports-checksum}", fu_hpi_cfu_image_reports_checksum_func);
+	g_test_add_func("/hpi-cfu/manifest{lookup}", fu_hpi_cfu_manifest_lookup_func);
+	g_test_add_func("/hpi-cfu/manifest{invalid}", fu_hpi_cfu_manifest_invalid_func);
+	g_test_add_func("/hpi-cfu/recorder", fu_hpi_cfu_recorder_func);
+	g_test_add_func("/hpi-cfu/device{activate}", fu_hpi_cfu_device_activate_func);
+	return g_test_run();
+}
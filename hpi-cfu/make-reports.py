@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Owner Name <ananth.kunchaka@hp.com>
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+# pylint: disable=invalid-name,missing-docstring
+
+"""Convert a *.payload.bin into the pre-packetized *.reports.bin format"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+FIRMWARE_REPORT_ID = 0x20
+PAYLOAD_LENGTH = 52
+CONTENT_FLAG_FIRST_BLOCK = 0x80
+CONTENT_FLAG_LAST_BLOCK = 0x40
+
+# FuStructHpiCfuPayloadRecord
+RECORD_FMT = "<IB"
+
+# FuStructHpiCfuPayloadCmd
+REPORT_FMT = "<BBBHI52s"
+
+# FuStructHpiCfuReportsHdr
+HDR_FMT = "<4sHHIII"
+HDR_MAGIC = b"HPCR"
+HDR_VERSION = 1
+
+
+def _parse_records(buf: bytes) -> list:
+    records = []
+    offset = 0
+    while offset < len(buf):
+        address, length = struct.unpack_from(RECORD_FMT, buf, offset)
+        offset += struct.calcsize(RECORD_FMT)
+        if length == 0:
+            raise ValueError(f"record at 0x{offset:x} has zero length")
+        if offset + length > len(buf):
+            raise ValueError(f"record at 0x{offset:x} overruns the payload")
+        records.append((address, buf[offset : offset + length]))
+        offset += length
+    if not records:
+        raise ValueError("payload has no records")
+    return records
+
+
+# merge records that follow on directly from the one before, keeping the gaps
+def _merge_records(records: list) -> list:
+    runs = []
+    for address, data in records:
+        if runs and runs[-1][0] + len(runs[-1][1]) == address:
+            runs[-1][1].extend(data)
+        else:
+            runs.append((address, bytearray(data)))
+    return runs
+
+
+# must match fu_hpi_cfu_image_packetize()
+def _packetize(records: list) -> list:
+    chunks = []
+    for address, data in _merge_records(records):
+        for i in range(0, len(data), PAYLOAD_LENGTH):
+            chunk = bytes(data[i : i + PAYLOAD_LENGTH])
+            if address + i + len(chunk) > 0xFFFFFFFF:
+                raise ValueError(
+                    f"payload too large, report at 0x{address + i:x} overflows"
+                )
+            chunks.append((address + i, chunk))
+
+    reports = []
+    for idx, (address, chunk) in enumerate(chunks):
+        flags = 0
+        if idx == 0:
+            flags |= CONTENT_FLAG_FIRST_BLOCK
+        if idx == len(chunks) - 1:
+            flags |= CONTENT_FLAG_LAST_BLOCK
+        reports.append(
+            struct.pack(
+                REPORT_FMT,
+                FIRMWARE_REPORT_ID,
+                flags,
+                len(chunk),
+                (idx + 1) & 0xFFFF,
+                address,
+                chunk,
+            )
+        )
+    return reports
+
+
+def main(args) -> int:
+    with open(args.payload, "rb") as f:
+        payload = f.read()
+    try:
+        reports = _packetize(_parse_records(payload))
+    except (ValueError, struct.error) as e:
+        print(f"failed to convert {args.payload}: {e}", file=sys.stderr)
+        return 1
+    blob = b"".join(reports)
+    hdr = struct.pack(
+        HDR_FMT,
+        HDR_MAGIC,
+        HDR_VERSION,
+        struct.calcsize(REPORT_FMT),
+        len(reports),
+        len(payload),
+        zlib.crc32(blob),
+    )
+    with open(args.reports, "wb") as f:
+        f.write(hdr + blob)
+    print(f"wrote {len(reports)} reports to {args.reports}")
+    return 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("payload", help="the *.payload.bin to convert")
+    parser.add_argument("reports", help="the *.reports.bin to write")
+    sys.exit(main(parser.parse_args()))